@@ -0,0 +1,50 @@
+#if !defined(ARENA)
+#define ARENA
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "waveform.cpp"
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+namespace synth {
+    using namespace std;
+
+    constexpr size_t cacheLine = 64UL;
+
+    constexpr size_t hugePage = 2UL << 20;
+
+    struct FreeSamples {
+        void operator()(int_osc_t *samples) const { free(samples); }
+    };
+
+    using Samples = unique_ptr<int_osc_t[], FreeSamples>;
+
+    // Count zeroed samples in one block aligned to a cache line, or, once
+    // the block spans a huge page, aligned to one and offered to the
+    // kernel to back with huge pages.
+    Samples allocateSamples(const size_t count) {
+        const size_t bytes = max(count, 1UL) * sizeof(int_osc_t);
+        const size_t align = bytes >= hugePage ? hugePage : cacheLine;
+        const size_t size = (bytes + align - 1UL) / align * align;
+        auto *samples = static_cast<int_osc_t *>(aligned_alloc(align, size));
+
+        if (!samples)
+            throw bad_alloc();
+
+#if defined(__linux__)
+        if (align == hugePage)
+            madvise(samples, size, MADV_HUGEPAGE);
+#endif
+
+        memset(samples, 0, size);
+
+        return Samples(samples);
+    }
+}
+
+#endif
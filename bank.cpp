@@ -0,0 +1,360 @@
+#if !defined(BANK)
+#define BANK
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "arena.cpp"
+#include "cache.cpp"
+#include "engine.cpp"
+#include "voicing.cpp"
+#include "waveform.cpp"
+#include "wavetable.cpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace synth;
+
+// A voicing and the envelope it is played with.
+struct Preset {
+    Voicing voicing;
+    Envelope envelope;
+};
+
+// Presets kept in one file, each saved with the tables it played from:
+//
+//     header | a record per preset | tables by digest | their samples
+//
+// The file is mapped rather than read. Opening it checks no more than
+// the header and the table index, a preset is decoded when it is chosen,
+// and a table's pages are faulted in only once the table cache asks for
+// it, so a bank of any size opens at once and costs memory only for what
+// is played. Tables go by the table cache's digest: one saved at another
+// rate misses and is built as usual. Adding a preset rewrites the file
+// under a temporary name and renames it over the old one.
+class PresetBank : public TableSource {
+public:
+    PresetBank() = default;
+
+    ~PresetBank() { _unmap(); }
+
+    PresetBank(const PresetBank &) = delete;
+    PresetBank &operator=(const PresetBank &) = delete;
+
+    // Maps the bank at path; a missing file is an empty bank, created
+    // there by the first add().
+    bool open(const string &path) {
+        auto lock = unique_lock(_mutex);
+        auto error = error_code();
+
+        _unmap();
+        _path = path;
+
+        return !filesystem::exists(path, error) or _map();
+    }
+
+    int64_t size() const {
+        auto lock = unique_lock(_mutex);
+
+        return _presets;
+    }
+
+    Preset at(const int64_t index) const {
+        auto lock = unique_lock(_mutex);
+
+        return _decode(_records[index]);
+    }
+
+    bool read(const uint64_t digest, Mipmap &mipmap) override {
+        auto lock = unique_lock(_mutex);
+        const auto *end = _tables + _count;
+        const auto *found = lower_bound(
+            _tables, end, digest,
+            [](const Table &table, const uint64_t digest) {
+                return table.digest < digest;
+            });
+        const auto samples = mipmap.samples();
+
+        if (found == end or found->digest != digest or
+            found->samples != samples.size())
+            return false;
+
+        memcpy(samples.data(), _data + found->offset,
+               samples.size() * sizeof(int_osc_t));
+
+        return true;
+    }
+
+    // Appends preset, with the mipmap built for key, and rewrites the
+    // file; the bank stays as it was if that fails.
+    bool add(const Preset &preset, const TableKey &key, const Mipmap &mipmap) {
+        auto lock = unique_lock(_mutex);
+        auto records = vector<Record>(_records, _records + _presets);
+        auto tables = vector<Table>(_tables, _tables + _count);
+        const uint64_t digest = TableCache::digest(key, mipmap);
+        const auto samples = mipmap.samples();
+
+        records.push_back(_encode(preset));
+        erase_if(tables,
+                 [&](const Table &table) { return table.digest == digest; });
+        tables.push_back({digest, 0UL, samples.size()});
+        sort(tables.begin(), tables.end(), [](const auto &a, const auto &b) {
+            return a.digest < b.digest;
+        });
+
+        auto sources = vector<const int_osc_t *>();
+        uint64_t offset = sizeof(Header) + records.size() * sizeof(Record) +
+                          tables.size() * sizeof(Table);
+
+        for (auto &table : tables) {
+            const auto *stored = _data + table.offset;
+
+            sources.push_back(
+                table.digest == digest
+                    ? samples.data()
+                    : reinterpret_cast<const int_osc_t *>(stored));
+            offset = _align(offset);
+            table.offset = offset;
+            offset += table.samples * sizeof(int_osc_t);
+        }
+
+        if (!_write(records, tables, sources))
+            return false;
+
+        _unmap();
+
+        return _map();
+    }
+
+    constexpr static uint64_t version = 1UL;
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t version;
+        uint64_t presets;
+        uint64_t tables;
+    };
+
+    struct Record {
+        int64_t select;
+        int64_t approx;
+        double division;
+        uint64_t seed;
+        int32_t precision;
+        int32_t derivation;
+        uint8_t reverse;
+        uint8_t mirror;
+        uint8_t padding[6];
+        float attack;
+        float decay;
+        float sustain;
+        float release;
+    };
+
+    static_assert(sizeof(Record) == 64UL);
+
+    struct Table {
+        uint64_t digest;
+        uint64_t offset;
+        uint64_t samples;
+    };
+
+    constexpr static char _magic[8] = {'S', 'Y', 'N', 'T', 'H', 'B', 'N', 'K'};
+
+    static uint64_t _align(const uint64_t offset) {
+        return (offset + cacheLine - 1UL) / cacheLine * cacheLine;
+    }
+
+    static Record _encode(const Preset &preset) {
+        const auto &voicing = preset.voicing;
+        const auto &envelope = preset.envelope;
+
+        return {voicing.select,
+                voicing.approx,
+                double(voicing.division),
+                voicing.seed,
+                int32_t(voicing.precision),
+                int32_t(voicing.derivation),
+                voicing.reverse,
+                voicing.mirror,
+                {},
+                envelope.attack,
+                envelope.decay,
+                envelope.sustain,
+                envelope.release};
+    }
+
+    // Fields out of range fall back to their defaults rather than reach
+    // the builders.
+    static Preset _decode(const Record &record) {
+        auto preset = Preset();
+        auto &voicing = preset.voicing;
+
+        if (record.select >= 0L and record.select < waveforms)
+            voicing.select = record.select;
+
+        voicing.approx = max(record.approx, 1L);
+
+        if (isfinite(record.division))
+            voicing.division = record.division;
+
+        voicing.seed = record.seed;
+        voicing.reverse = record.reverse;
+        voicing.mirror = record.mirror;
+
+        if (record.precision >= 0 and record.precision <= 2)
+            voicing.precision = Precision(record.precision);
+
+        if (record.derivation >= 0 and record.derivation <= 1)
+            voicing.derivation = Derivation(record.derivation);
+
+        preset.envelope = {max(0.0f, record.attack), max(0.0f, record.decay),
+                           min(max(0.0f, record.sustain), 1.0f),
+                           max(0.0f, record.release)};
+
+        return preset;
+    }
+
+    // Maps _path and checks that its index, and every table the index
+    // points at, lie within the file.
+    bool _map() {
+#if defined(__linux__)
+        const int file = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat status;
+
+        if (file < 0)
+            return false;
+
+        if (fstat(file, &status) != 0 or
+            size_t(status.st_size) < sizeof(Header)) {
+            close(file);
+            return false;
+        }
+
+        const size_t size = status.st_size;
+        void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+        close(file);
+
+        if (data == MAP_FAILED)
+            return false;
+
+        madvise(data, size, MADV_RANDOM);
+        _data = static_cast<const char *>(data);
+        _size = size;
+
+        const auto *header = reinterpret_cast<const Header *>(_data);
+        const uint64_t index =
+            sizeof(Header) + header->presets * sizeof(Record) +
+            header->tables * sizeof(Table);
+        bool valid = memcmp(header->magic, _magic, sizeof(_magic)) == 0 and
+                     header->version == version and
+                     header->presets <= size / sizeof(Record) and
+                     header->tables <= size / sizeof(Table) and index <= size;
+
+        if (valid) {
+            _presets = header->presets;
+            _count = header->tables;
+            _records = reinterpret_cast<const Record *>(header + 1);
+            _tables = reinterpret_cast<const Table *>(_records + _presets);
+        }
+
+        for (int64_t i = 0; valid and i < _count; ++i) {
+            const auto &table = _tables[i];
+
+            const uint64_t room = (size - min(table.offset, size)) /
+                                  sizeof(int_osc_t);
+
+            valid = table.offset >= index and table.samples <= room and
+                    table.offset % alignof(int_osc_t) == 0UL and
+                    (i == 0L or _tables[i - 1L].digest < table.digest);
+        }
+
+        if (!valid)
+            _unmap();
+
+        return valid;
+#else
+        return false;
+#endif
+    }
+
+    void _unmap() {
+#if defined(__linux__)
+        if (_data)
+            munmap(const_cast<char *>(_data), _size);
+#endif
+        _data = nullptr;
+        _size = 0UL;
+        _records = nullptr;
+        _tables = nullptr;
+        _presets = 0L;
+        _count = 0L;
+    }
+
+    bool _write(const vector<Record> &records, const vector<Table> &tables,
+                const vector<const int_osc_t *> &sources) const {
+        const auto temporary = _path + "." + to_string(entropySeed());
+        auto header = Header{{}, version, records.size(), tables.size()};
+        FILE *file = fopen(temporary.c_str(), "wb");
+
+        if (!file)
+            return false;
+
+        memcpy(header.magic, _magic, sizeof(_magic));
+
+        bool written =
+            fwrite(&header, sizeof(header), 1, file) == 1 and
+            fwrite(records.data(), sizeof(Record), records.size(), file) ==
+                records.size() and
+            fwrite(tables.data(), sizeof(Table), tables.size(), file) ==
+                tables.size();
+
+        for (size_t i = 0; written and i < tables.size(); ++i)
+            written = fseek(file, tables[i].offset, SEEK_SET) == 0 and
+                      fwrite(sources[i], sizeof(int_osc_t), tables[i].samples,
+                             file) == tables[i].samples;
+
+        written = fclose(file) == 0 and written;
+
+        auto error = error_code();
+
+        if (written)
+            filesystem::rename(temporary, _path, error);
+
+        if (!written or error)
+            filesystem::remove(temporary, error);
+
+        return written and !error;
+    }
+
+    string _path;
+
+    const char *_data = nullptr;
+
+    size_t _size = 0UL;
+
+    const Record *_records = nullptr;
+
+    const Table *_tables = nullptr;
+
+    int64_t _presets = 0L;
+
+    int64_t _count = 0L;
+
+    mutable mutex _mutex;
+};
+
+#endif
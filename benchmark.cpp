@@ -0,0 +1,424 @@
+#include "engine.cpp"
+#include "instrument.cpp"
+#include "kernel.cpp"
+#include "noise.cpp"
+#include "partials.cpp"
+#include "renderer.cpp"
+#include "resample.cpp"
+#include "spectrum.cpp"
+#include "waveform.cpp"
+#include "wavetable.cpp"
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace synth;
+
+// Times the waveform builders, the organ's table build and the voice
+// engine without a window or an audio device, and prints one row per
+// measurement as CSV or JSON for tracking throughput across commits.
+// It still links SFML's audio module, for the sound streams the engine
+// and the organ declare:
+//
+//     g++ -std=c++20 -O2 -pthread benchmark.cpp -o benchmark
+//         -lsfml-audio -lsfml-system
+//     benchmark [--format csv|json] [--rates 44100,48000,96000]
+//               [--approx 1,10,100] [--threads 1] [--repeat 5]
+//               [--output file]
+//     benchmark --verify
+//
+// The engine runs once per thread count; rows beyond one thread are
+// named after the team, e.g. team4.
+//
+// --verify instead checks every waveform's symmetric build against its
+// variadic one, and every vectorized kernel in double and in float
+// against the long double waveform, over even and odd cycles, and fails
+// on any deviation beyond a rounding step.
+
+struct Row {
+    string kind;
+    string builder;
+    string waveform;
+    int64_t approx;
+    int64_t voices;
+    float128_t rate;
+    int64_t samples;
+    float128_t seconds;
+};
+
+struct Waveform {
+    string name;
+    bool fourier;
+    Symmetry symmetry;
+    function<FillWavetable(int64_t)> fill;
+    function<Spectrum(int64_t)> spectrum;
+};
+
+vector<int64_t> parseList(const string &list) {
+    auto values = vector<int64_t>();
+    auto stream = istringstream(list);
+    auto value = string();
+
+    while (getline(stream, value, ','))
+        values.push_back(stoll(value));
+
+    return values;
+}
+
+// The best of repeat runs, in seconds.
+float128_t measure(const function<void()> &task, const int64_t repeat) {
+    auto best = float128_t(INFINITY);
+
+    for (int64_t i = 0; i < repeat; ++i) {
+        const auto start = steady_clock::now();
+        task();
+        best = min<float128_t>(
+            best, duration<float128_t>(steady_clock::now() - start).count());
+    }
+
+    return best;
+}
+
+// One table per organ note, each a single cycle at the output rate.
+vector<vector<int_osc_t>> noteTables(const float128_t rate) {
+    auto tables = vector<vector<int_osc_t>>();
+
+    for (int64_t note = 0; note < Organ::getKeys(); ++note)
+        tables.emplace_back(
+            max<int64_t>(round(rate / Organ::getFrequency(note)), 4L));
+
+    return tables;
+}
+
+void buildNotes(const BuildWavetable &build,
+                vector<vector<int_osc_t>> &tables) {
+    for (auto &table : tables)
+        build(table, tpc2Freq(table.size()), maxAmp);
+}
+
+int64_t totalSamples(const vector<vector<int_osc_t>> &tables) {
+    int64_t samples = 0;
+
+    for (const auto &table : tables)
+        samples += table.size();
+
+    return samples;
+}
+
+void print(ostream &out, const vector<Row> &rows, const string &format) {
+    if (format == "json") {
+        out << "[\n";
+
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const auto &row = rows[i];
+
+            out << "  {\"kind\": \"" << row.kind << "\", \"builder\": \""
+                << row.builder << "\", \"waveform\": \"" << row.waveform
+                << "\", \"approx\": " << row.approx
+                << ", \"voices\": " << row.voices
+                << ", \"rate\": " << int64_t(row.rate)
+                << ", \"samples\": " << row.samples
+                << ", \"seconds\": " << double(row.seconds)
+                << ", \"throughput\": " << double(row.samples / row.seconds)
+                << "}" << (i + 1 < rows.size() ? "," : "") << "\n";
+        }
+
+        out << "]\n";
+        return;
+    }
+
+    out << "kind,builder,waveform,approx,voices,rate,samples,seconds,"
+           "throughput\n";
+
+    for (const auto &row : rows)
+        out << row.kind << "," << row.builder << "," << row.waveform << ","
+            << row.approx << "," << row.voices << "," << int64_t(row.rate)
+            << "," << row.samples << "," << double(row.seconds) << ","
+            << double(row.samples / row.seconds) << "\n";
+}
+
+int main(int argc, char **argv) {
+    auto format = string("csv");
+    auto rates = vector<int64_t>{44100L, 48000L, 96000L};
+    auto approxes = vector<int64_t>{1L, 10L, 100L};
+    auto threads = vector<int64_t>{1L};
+    auto repeat = 5L;
+    auto output = string();
+    auto verify = false;
+
+    for (int64_t i = 1; i < argc; ++i) {
+        const auto option = string(argv[i]);
+
+        if (option == "--verify") {
+            verify = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << option << endl;
+            return 1;
+        }
+
+        if (option == "--format")
+            format = argv[++i];
+        else if (option == "--rates")
+            rates = parseList(argv[++i]);
+        else if (option == "--approx")
+            approxes = parseList(argv[++i]);
+        else if (option == "--threads")
+            threads = parseList(argv[++i]);
+        else if (option == "--repeat")
+            repeat = max(stoll(argv[++i]), 1LL);
+        else if (option == "--output")
+            output = argv[++i];
+        else {
+            cerr << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+
+    const auto waveforms = vector<Waveform>{
+        {"sine", false, symmetryOf(sineWaveform),
+         [](int64_t) { return evaluate(sineWaveform); }, {}},
+        {"triangle", false, symmetryOf(triangleWaveform),
+         [](int64_t) { return evaluate(triangleWaveform); }, {}},
+        {"triangle-fourier", true, symmetryOf(triangleWaveformFourier(1L)),
+         [](int64_t approx) {
+             return evaluate(triangleWaveformFourier(approx));
+         },
+         triangleSpectrum},
+        {"square", false, symmetryOf(squareWaveform(0.5L)),
+         [](int64_t) { return evaluate(squareWaveform(0.5L)); }, {}},
+        {"square-fourier", true, symmetryOf(squareWaveformFourier(1L)),
+         [](int64_t approx) {
+             return evaluate(squareWaveformFourier(approx));
+         },
+         squareSpectrum},
+        {"sawtooth", false, symmetryOf(sawtoothWaveform),
+         [](int64_t) { return evaluate(sawtoothWaveform); }, {}},
+        {"sawtooth-fourier", true, symmetryOf(sawtoothWaveformFourier(1L)),
+         [](int64_t approx) {
+             return evaluate(sawtoothWaveformFourier(approx));
+         },
+         sawtoothSpectrum},
+        {"sine-pulse", false, symmetryOf(sinePulseWaveform),
+         [](int64_t) { return evaluate(sinePulseWaveform); }, {}},
+        {"sine-pulse-fourier", true, symmetryOf(sinePulseWaveformFourier(1L)),
+         [](int64_t approx) {
+             return evaluate(sinePulseWaveformFourier(approx));
+         },
+         sinePulseSpectrum},
+        {"white-noise", false, symmetryOf(Noise{Noise::White, 1UL}),
+         [](int64_t) { return evaluate(Noise{Noise::White, 1UL}); }, {}},
+        {"pink-noise", false, symmetryOf(Noise{Noise::Pink, 1UL}),
+         [](int64_t) { return evaluate(Noise{Noise::Pink, 1UL}); }, {}},
+        {"brown-noise", false, symmetryOf(Noise{Noise::Brown, 1UL}),
+         [](int64_t) { return evaluate(Noise{Noise::Brown, 1UL}); }, {}}};
+
+    const auto builders =
+        vector<pair<string, BuildWavetable (*)(FillWavetable)>>{
+            {"variadic", variadic},
+            {"axisymmetric", axisymmetric},
+            {"pointsymmetric", pointsymmetric},
+            {"periodic", periodic}};
+
+    if (verify) {
+        const auto lengths = {cycleLength, cycleLength - 1L, 110L, 109L};
+        int64_t failures = 0;
+
+        auto precise = [&](const string &name, auto apply,
+                           const Kernel kernel) {
+            for (const auto precision : {Precision::Double, Precision::Single})
+                for (const int64_t tpc : lengths) {
+                    const int64_t error = precisionError(
+                        apply, kernel, precision, tpc2Freq(tpc));
+
+                    if (error > 1L) {
+                        cerr << name << " kernel ("
+                             << (precision == Precision::Double ? "double"
+                                                                : "float")
+                             << ", " << tpc << " samples): " << error
+                             << " LSB from long double" << endl;
+                        ++failures;
+                    }
+                }
+        };
+
+        precise("sine", sineWaveform, Kernel{Kernel::Sine});
+        precise("triangle", triangleWaveform, Kernel{Kernel::Triangle});
+        precise("square", squareWaveform(0.5L), Kernel{Kernel::Square});
+        precise("square 0.25", squareWaveform(0.25L),
+                Kernel{Kernel::Square, 0.25L});
+        precise("sawtooth", sawtoothWaveform, Kernel{Kernel::Sawtooth});
+        precise("sine-pulse", sinePulseWaveform, Kernel{Kernel::SinePulse});
+
+        for (const auto &waveform : waveforms)
+            for (const auto approx : approxes)
+                for (const int64_t tpc : lengths) {
+                    const auto fill = waveform.fill(approx);
+                    const int64_t error = symmetryError(
+                        symmetric(fill, waveform.symmetry), variadic(fill),
+                        tpc);
+
+                    if (error > 1L) {
+                        cerr << waveform.name << " (approx " << approx
+                             << ", " << tpc << " samples): " << error
+                             << " LSB from variadic" << endl;
+                        ++failures;
+                    }
+                }
+
+        return failures ? 1 : 0;
+    }
+
+    auto rows = vector<Row>();
+
+    for (const auto rate : rates) {
+        auto tables = noteTables(rate);
+        const int64_t samples = totalSamples(tables);
+
+        for (const auto &waveform : waveforms) {
+            for (const auto approx : approxes) {
+                if (!waveform.fourier and approx != approxes.front())
+                    continue;
+
+                const int64_t shown = waveform.fourier ? approx : 0L;
+
+                for (const auto &[name, builder] : builders) {
+                    const auto build = builder(waveform.fill(approx));
+
+                    rows.push_back(
+                        {"builder", name, waveform.name, shown, 0L,
+                         float128_t(rate), samples,
+                         measure([&]() { buildNotes(build, tables); },
+                                 repeat)});
+                }
+
+                {
+                    const auto build =
+                        symmetric(waveform.fill(approx), waveform.symmetry);
+
+                    rows.push_back(
+                        {"builder", "symmetric", waveform.name, shown, 0L,
+                         float128_t(rate), samples,
+                         measure([&]() { buildNotes(build, tables); },
+                                 repeat)});
+                }
+
+                if (waveform.fourier) {
+                    const auto build = additive(waveform.spectrum(approx));
+
+                    rows.push_back(
+                        {"builder", "additive", waveform.name, shown, 0L,
+                         float128_t(rate), samples,
+                         measure([&]() { buildNotes(build, tables); },
+                                 repeat)});
+                }
+            }
+        }
+
+        // The organ as it is built: one mipmap over its whole range.
+        for (const auto &waveform : waveforms) {
+            auto bank = Mipmap(Organ::getFrequency(0L),
+                               Organ::getFrequency(Organ::getKeys() - 1L),
+                               rate);
+            const auto build = variadic(waveform.fill(approxes.front()));
+            int64_t levels = 0;
+
+            for (const auto &level : bank.levels)
+                levels += level.size();
+
+            rows.push_back(
+                {"organ", "mipmap", waveform.name,
+                 waveform.fourier ? approxes.front() : 0L, 0L,
+                 float128_t(rate), levels,
+                 measure([&]() { renderMipmap(bank, build); }, repeat)});
+            rows.push_back(
+                {"organ", "resample", waveform.name,
+                 waveform.fourier ? approxes.front() : 0L, 0L,
+                 float128_t(rate), levels,
+                 measure([&]() { resampleMipmap(bank, build); }, repeat)});
+
+            // One approx step at a time, as the organ follows a sweep.
+            if (waveform.fourier) {
+                auto partials = Partials(bank);
+                int64_t approx = approxes.front();
+
+                partials.retune(waveform.spectrum(approx), bank);
+                rows.push_back(
+                    {"organ", "partials", waveform.name, approx, 0L,
+                     float128_t(rate), levels,
+                     measure(
+                         [&]() {
+                             partials.retune(waveform.spectrum(++approx),
+                                             bank);
+                         },
+                         repeat)});
+            }
+        }
+
+        // Sixteen, then sixty-four, sustained voices across the organ's
+        // range for ten seconds, in the engine's own blocks.
+        auto bank = Mipmap(Organ::getFrequency(0L),
+                           Organ::getFrequency(Organ::getKeys() - 1L), rate);
+        renderMipmap(bank, variadic(sineWaveform));
+
+        const int64_t frames = 10L * rate;
+        auto out = vector<int_osc_t>(frames);
+
+        for (const int64_t voices : {16L, 64L})
+            for (const int64_t team : threads) {
+                const auto name =
+                    team > 1L ? "team" + to_string(team) : "polyphony";
+
+                rows.push_back(
+                    {"engine", name, "sine", 0L, voices, float128_t(rate),
+                     frames,
+                     measure(
+                         [&]() {
+                             auto engine =
+                                 Engine(rate, voices, 256L, 1L, team);
+
+                             engine.use(bank);
+
+                             for (int64_t key = 0; key < voices; ++key) {
+                                 const int64_t note =
+                                     key * Organ::getKeys() / voices;
+
+                                 engine.noteOn(note,
+                                               Organ::getFrequency(note),
+                                               0.5L / voices);
+                             }
+
+                             for (int64_t i = 0; i < frames;
+                                  i += engine.getBlock())
+                                 engine.render(
+                                     out.data() + i,
+                                     min(engine.getBlock(), frames - i));
+                         },
+                         repeat)});
+            }
+    }
+
+    if (output.empty()) {
+        print(cout, rows, format);
+        return 0;
+    }
+
+    auto file = ofstream(output);
+
+    print(file, rows, format);
+
+    if (!file) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+
+    return 0;
+}
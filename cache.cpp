@@ -0,0 +1,330 @@
+#if !defined(CACHE)
+#define CACHE
+
+#include "arena.cpp"
+#include "kernel.cpp"
+#include "noise.cpp"
+#include "resample.cpp"
+#include "waveform.cpp"
+#include "wavetable.cpp"
+#include <bit>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace synth;
+
+// Everything the frontend varies that changes a table's samples. Fields a
+// waveform ignores are left at their defaults, so that e.g. the sine does
+// not miss the cache after approx changes.
+struct TableKey {
+    int64_t waveform = 0L;
+    int64_t approx = 0L;
+    float128_t division = 0.0L;
+    bool reverse = false;
+    Precision precision = Precision::Reference;
+    uint64_t seed = 0UL;
+    Derivation derivation = Derivation::Spectral;
+};
+
+// A waveform as the instruments receive it: how to build its tables, what
+// they are cached under and what the telemetry calls them. Additive
+// waveforms also pass their spectrum, from which the organ can retune its
+// tables harmonic by harmonic.
+struct Patch {
+    BuildWavetable build;
+    TableKey key;
+    string name;
+    Spectrum spectrum = {};
+};
+
+// Somewhere else a mipmap may already be stored, by the cache's digest,
+// such as a bank of presets saved with their tables.
+class TableSource {
+public:
+    virtual ~TableSource() = default;
+
+    virtual bool read(uint64_t digest, Mipmap &mipmap) = 0;
+};
+
+// Recently built mipmaps, by a digest of their key and their geometry: in
+// memory up to capacity slots, least recently used first out, and in one
+// file per digest under the directory, if one is open. A slot is one flat
+// arena that later tables are copied over, and only grows when a larger
+// mipmap lands in it, so the memory tier is bounded and, once warm,
+// stores without allocating. Files are mapped and copied in on a hit, and
+// written to a temporary name and renamed on a store, so that concurrent
+// processes never see half a table. An attached source is asked after
+// memory and before the files. Bump version whenever a builder's output
+// changes.
+class TableCache {
+public:
+    TableCache(const int64_t capacity = 64L) : _slots(max(capacity, 1L)) {}
+
+    bool open(const string &directory) {
+        auto error = error_code();
+
+        if (directory.size() + 64UL > sizeof(_file))
+            error = make_error_code(errc::filename_too_long);
+        else
+            filesystem::create_directories(directory, error);
+
+        auto lock = unique_lock(_mutex);
+        _directory = error ? string() : directory;
+
+        return !error;
+    }
+
+    void attach(TableSource *source) {
+        auto lock = unique_lock(_mutex);
+
+        _source = source;
+    }
+
+    bool load(const TableKey &key, Mipmap &mipmap) {
+        const uint64_t digest = TableCache::digest(key, mipmap);
+        auto lock = unique_lock(_mutex);
+        const auto samples = mipmap.samples();
+
+        for (auto &slot : _slots)
+            if (slot.used and slot.digest == digest and
+                slot.size == samples.size()) {
+                memcpy(samples.data(), slot.samples.get(),
+                       samples.size_bytes());
+                slot.used = ++_clock;
+                return true;
+            }
+
+        if (_source and _source->read(digest, mipmap))
+            return true;
+
+        if (_directory.empty() or !_read(_path(digest), digest, mipmap))
+            return false;
+
+        _remember(digest, mipmap);
+
+        return true;
+    }
+
+    void store(const TableKey &key, const Mipmap &mipmap) {
+        const uint64_t digest = TableCache::digest(key, mipmap);
+        auto lock = unique_lock(_mutex);
+
+        _remember(digest, mipmap);
+
+        if (!_directory.empty())
+            _write(_path(digest), digest, mipmap);
+    }
+
+    constexpr static uint64_t version = 3UL;
+
+    // What a mipmap of this geometry built for key is kept under.
+    static uint64_t digest(const TableKey &key, const Mipmap &mipmap) {
+        const uint64_t fields[] = {
+            version,
+            uint64_t(key.waveform),
+            uint64_t(key.approx),
+            bit_cast<uint64_t>(double(key.division)),
+            uint64_t(key.reverse),
+            uint64_t(key.precision),
+            key.seed,
+            uint64_t(key.derivation),
+            bit_cast<uint64_t>(double(mipmap.base)),
+            bit_cast<uint64_t>(double(mipmap.rate)),
+            uint64_t(mipmap.levels.size()),
+            uint64_t(cycleLength)};
+        uint64_t digest = 0UL;
+
+        for (const uint64_t field : fields)
+            digest = counterHash(digest, field);
+
+        return digest;
+    }
+
+private:
+    struct Slot {
+        uint64_t digest = 0UL;
+        uint64_t used = 0UL;
+        Samples samples;
+        size_t size = 0UL;
+        size_t room = 0UL;
+    };
+
+    struct Header {
+        char magic[8];
+        uint64_t digest;
+        int64_t levels;
+        int64_t samples;
+    };
+
+    constexpr static char _magic[8] = {'S', 'Y', 'N', 'T', 'H', 'T', 'B', 'L'};
+
+    static int64_t _samples(const Mipmap &mipmap) {
+        return mipmap.samples().size();
+    }
+
+    // The file for digest, written into a buffer of the cache's own.
+    const char *_path(const uint64_t digest) {
+        snprintf(_file, sizeof(_file), "%s/%016lx.table", _directory.c_str(),
+                 digest);
+
+        return _file;
+    }
+
+    // Copies mipmap into the slot already holding digest, else over the
+    // least recently used one.
+    void _remember(const uint64_t digest, const Mipmap &mipmap) {
+        const auto samples = mipmap.samples();
+        auto *chosen = &_slots.front();
+
+        for (auto &slot : _slots) {
+            if (slot.used and slot.digest == digest) {
+                chosen = &slot;
+                break;
+            }
+
+            if (slot.used < chosen->used)
+                chosen = &slot;
+        }
+
+        if (chosen->room < samples.size()) {
+            chosen->samples = allocateSamples(samples.size());
+            chosen->room = samples.size();
+        }
+
+        memcpy(chosen->samples.get(), samples.data(), samples.size_bytes());
+        chosen->digest = digest;
+        chosen->size = samples.size();
+        chosen->used = ++_clock;
+    }
+
+    // Writes all of data, however many calls that takes.
+    static bool _put(const int file, const void *data, size_t size) {
+#if defined(__linux__)
+        const auto *bytes = static_cast<const char *>(data);
+
+        while (size > 0UL) {
+            const ssize_t count = ::write(file, bytes, size);
+
+            if (count < 0 and errno == EINTR)
+                continue;
+
+            if (count <= 0)
+                return false;
+
+            bytes += count;
+            size -= count;
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static bool _read(const char *path, const uint64_t digest,
+                      Mipmap &mipmap) {
+#if defined(__linux__)
+        const int file = ::open(path, O_RDONLY | O_CLOEXEC);
+        struct stat status;
+
+        if (file < 0)
+            return false;
+
+        if (fstat(file, &status) != 0) {
+            close(file);
+            return false;
+        }
+
+        const int64_t samples = _samples(mipmap);
+        const size_t size = sizeof(Header) + samples * sizeof(int_osc_t);
+        void *data = size_t(status.st_size) == size
+                         ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0)
+                         : MAP_FAILED;
+
+        close(file);
+
+        if (data == MAP_FAILED)
+            return false;
+
+        const auto *header = static_cast<const Header *>(data);
+        const bool valid =
+            memcmp(header->magic, _magic, sizeof(_magic)) == 0 and
+            header->digest == digest and
+            header->levels == int64_t(mipmap.levels.size()) and
+            header->samples == samples;
+
+        if (valid)
+            memcpy(mipmap.samples().data(),
+                   static_cast<const char *>(data) + sizeof(Header),
+                   samples * sizeof(int_osc_t));
+
+        munmap(data, size);
+
+        return valid;
+#else
+        return false;
+#endif
+    }
+
+    // Neither the write nor the rename allocates: the temporary's name
+    // goes into a buffer of the cache's own as well.
+    void _write(const char *path, const uint64_t digest,
+                const Mipmap &mipmap) {
+#if defined(__linux__)
+        auto header = Header{{}, digest, int64_t(mipmap.levels.size()),
+                             _samples(mipmap)};
+
+        snprintf(_temporary, sizeof(_temporary), "%s.%016lx", path,
+                 entropySeed());
+
+        const int file = ::open(_temporary, O_WRONLY | O_CREAT | O_EXCL |
+                                                O_CLOEXEC, 0644);
+
+        if (file < 0)
+            return;
+
+        memcpy(header.magic, _magic, sizeof(_magic));
+
+        const auto samples = mipmap.samples();
+        bool written = _put(file, &header, sizeof(header)) and
+                       _put(file, samples.data(), samples.size_bytes());
+
+        written = close(file) == 0 and written;
+
+        if (!written or rename(_temporary, path) != 0)
+            unlink(_temporary);
+#endif
+    }
+
+    string _directory;
+
+    char _file[PATH_MAX];
+
+    char _temporary[PATH_MAX + 32];
+
+    TableSource *_source = nullptr;
+
+    vector<Slot> _slots;
+
+    uint64_t _clock = 0UL;
+
+    mutex _mutex;
+};
+
+inline TableCache tableCache;
+
+#endif
@@ -0,0 +1,935 @@
+#if !defined(ENGINE)
+#define ENGINE
+
+#include <SFML/Audio.hpp>
+#include "mixer.cpp"
+#include "ring.cpp"
+#include "sink.cpp"
+#include "team.cpp"
+#include "telemetry.cpp"
+#include "waveform.cpp"
+#include "wavetable.cpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+using namespace sf;
+using namespace std;
+using namespace std::chrono;
+using namespace synth;
+
+// A patch's amplitude envelope: times in seconds, sustain as a fraction
+// of the note's velocity.
+struct Envelope {
+    float attack = 0.005f;
+    float decay = 0.0f;
+    float sustain = 1.0f;
+    float release = 0.03f;
+
+    bool operator==(const Envelope &) const = default;
+};
+
+// How the mix reaches the output: turned down by headroom decibels, then,
+// when limiting, held under ceiling decibels of full scale by a limiter
+// that recovers over recovery seconds. Whatever still passes full scale
+// saturates.
+struct Dynamics {
+    float headroom = 0.0f;
+    float ceiling = 0.0f;
+    float recovery = 0.1f;
+    bool limit = true;
+};
+
+// A ceiling in decibels of full scale, or "off" for none.
+bool parseCeiling(const string &value, Dynamics &dynamics) {
+    char *end = nullptr;
+
+    dynamics.limit = value != "off";
+
+    if (!dynamics.limit)
+        return true;
+
+    dynamics.ceiling = strtof(value.c_str(), &end);
+
+    return end != value.c_str() and *end == '\0';
+}
+
+// A sounding note: its phase is kept in cycles, so that it carries over
+// unchanged when the mipmap level or the whole mipmap changes under it.
+// The envelope level itself lives in the engine, next to every other
+// voice's, so that all of them advance in one pass.
+struct Voice {
+    enum Stage { Attack, Decay, Sustain, Release };
+
+    int64_t note = -1L;
+    int64_t part = 0L;
+    float128_t freq = 0.0L;
+    double phase = 0.0;
+    float gain = 0.0f;
+    uint64_t age = 0UL;
+    Stage stage = Attack;
+
+    bool isActive() const { return note >= 0L; }
+};
+
+// A note change stamped with the steady clock, in nanoseconds, when the
+// sequencer received it.
+struct NoteEvent {
+    enum Type { On, Off };
+
+    Type type;
+    int64_t note;
+    int64_t part;
+    float128_t freq;
+    float gain;
+    int64_t time;
+};
+
+// Mixes a fixed pool of voices into blocks of samples. Each voice plays a
+// note of one of a few parts, and every part has a mipmap of its own, so
+// that layered or split patches share the voices and only their tables
+// differ. Only active voices cost anything; when every voice is busy a
+// new note steals a free voice, else the oldest released one, else the
+// oldest. Envelopes move linearly and are stepped every control samples,
+// each voice ramping its gain across the step; a voice is freed once its
+// envelope falls back to silence.
+//
+// A new mipmap does not replace the one sounding at once: every voice of
+// its part crossfades from the old tables to the new over glide seconds,
+// and further mipmaps wait for the fade to finish, so that a parameter swept
+// while notes are held morphs the timbre rather than clicking through it.
+//
+// Notes reach the render path through a lock-free queue with a single
+// producer (the sequencer thread). Each render applies the events stamped
+// since the previous render at the same offset into its own block, so
+// notes keep their relative timing to the sample, one block late.
+//
+// The voices are rendered in chunks of grain, each into a sub-mix of its
+// own, and the sub-mixes are summed in chunk order; between events, with
+// at least parallel voices sounding, the chunks are shared out over a
+// team of threads. Either way the samples come out the same. Summing and
+// converting the mix to samples run on SIMD lanes, with every voice at
+// its velocity's gain and the whole under the dynamics' limiter.
+class Engine {
+public:
+    Engine(const float128_t rate, const int64_t capacity = 16L,
+           const int64_t block = 256L, const int64_t parts = 1L,
+           const int64_t threads = 1L)
+        : _rate(rate), _voices(capacity), _levels(capacity),
+          _starts(capacity), _slopes(capacity), _targets(capacity),
+          _mix(control + block),
+          _submixes((capacity + grain - 1L) / grain, vector<float>(block)),
+          _bounds((block + control - 1L) / control + 1L),
+          _team(min<int64_t>(threads, _submixes.size())),
+          _parts(max(parts, 1L)), _sounding(_parts.size() * notes) {}
+
+    void use(const Mipmap &mipmap, const int64_t part = 0L) {
+        if (part >= 0L and part < getParts())
+            _parts[part].mipmap.store(&mipmap, memory_order_release);
+    }
+
+    void glide(const float seconds) {
+        _glide.store(seconds, memory_order_relaxed);
+    }
+
+    // Whether the render path may still read mipmap: it is sounding or
+    // fading out in some part. A mipmap passed to use() counts once a
+    // render picks it up; until then the caller knows it is taken.
+    bool uses(const Mipmap &mipmap) const {
+        for (const auto &part : _parts)
+            if (part.playing.load(memory_order_acquire) == &mipmap or
+                part.fading.load(memory_order_acquire) == &mipmap)
+                return true;
+
+        return false;
+    }
+
+    // Takes effect from the next block; notes already sounding follow the
+    // new times from their next stage on.
+    void shape(const Envelope &envelope) {
+        _attack.store(envelope.attack, memory_order_relaxed);
+        _decay.store(envelope.decay, memory_order_relaxed);
+        _sustain.store(envelope.sustain, memory_order_relaxed);
+        _release.store(envelope.release, memory_order_relaxed);
+    }
+
+    // Takes effect from the next block.
+    void limit(const Dynamics &dynamics) {
+        _headroom.store(dynamics.headroom, memory_order_relaxed);
+        _ceiling.store(dynamics.ceiling, memory_order_relaxed);
+        _recovery.store(dynamics.recovery, memory_order_relaxed);
+        _limiting.store(dynamics.limit, memory_order_relaxed);
+    }
+
+    // A frequency ratio for every voice, as from a pitch wheel.
+    void bend(const float ratio) {
+        _bend.store(ratio, memory_order_relaxed);
+    }
+
+    // Ramped to across the next block.
+    void setVolume(const float volume) {
+        _volume.store(volume, memory_order_relaxed);
+    }
+
+    // Events are stamped with the steady clock unless given a time;
+    // notes outside the MIDI range or parts the engine lacks are ignored.
+    void noteOn(const int64_t note, const float128_t freq,
+                const float128_t gain, const int64_t time = now(),
+                const int64_t part = 0L) {
+        _post({NoteEvent::On, note, part, freq, float(gain), time});
+    }
+
+    void noteOff(const int64_t note, const int64_t time = now(),
+                 const int64_t part = 0L) {
+        _post({NoteEvent::Off, note, part, 0.0L, 0.0f, time});
+    }
+
+    bool isActive(const int64_t note, const int64_t part = 0L) const {
+        return _isValid(note, part) and
+               _sounding[_key(note, part)].load(memory_order_relaxed);
+    }
+
+    int64_t getBlock() const { return _mix.size() - control; }
+
+    // How many samples the output lags its notes by: the step the limiter
+    // holds back, while it limits.
+    int64_t getDelay() const {
+        return _limiting.load(memory_order_relaxed) ? control : 0L;
+    }
+
+    int64_t getParts() const { return _parts.size(); }
+
+    static int64_t now() {
+        return duration_cast<nanoseconds>(
+                   steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    constexpr static int64_t notes = 128L;
+
+    constexpr static int64_t grain = 4L;
+
+    constexpr static int64_t parallel = 8L;
+
+    constexpr static int64_t queue = 1024L;
+
+    void render(int_osc_t *out, const int64_t frames) {
+        const int64_t begun = now();
+
+        _render(out, frames);
+        _last = begun;
+        _measure(begun, frames);
+    }
+
+    // Renders the block that starts at start, in nanoseconds on the
+    // events' own clock rather than the steady clock, so that an offline
+    // caller posting the events due before the block's end gets every
+    // one at its exact sample. Nothing is timed.
+    void render(int_osc_t *out, const int64_t frames, const int64_t start) {
+        _last = start;
+        _render(out, frames);
+        _stamped = 0L;
+    }
+
+private:
+    void _render(int_osc_t *out, const int64_t frames) {
+        const float volume = _gain;
+        bool limited = false;
+
+        _switch();
+
+        _envelope = {_attack.load(memory_order_relaxed),
+                     _decay.load(memory_order_relaxed),
+                     _sustain.load(memory_order_relaxed),
+                     _release.load(memory_order_relaxed)};
+        _dynamics = {_headroom.load(memory_order_relaxed),
+                     _ceiling.load(memory_order_relaxed),
+                     _recovery.load(memory_order_relaxed),
+                     _limiting.load(memory_order_relaxed)};
+        _ratio = _bend.load(memory_order_relaxed);
+        _gain = _volume.load(memory_order_relaxed);
+
+        if (_delay != (_dynamics.limit ? control : 0L)) {
+            _delay = _dynamics.limit ? control : 0L;
+            fill(_mix.begin(), _mix.begin() + control, 0.0f);
+        }
+
+        for (auto &part : _parts)
+            part.origin = part.blend;
+
+        for (int64_t start = 0; start < frames; start += getBlock()) {
+            const int64_t count = min<int64_t>(getBlock(), frames - start);
+            int64_t from = 0;
+
+            for (auto &submix : _submixes)
+                fill(submix.begin(), submix.begin() + count, 0.0f);
+
+            while (true) {
+                if (!_next and _events.pop(_event))
+                    _next = &_event;
+
+                const int64_t at =
+                    _next ? _offset(*_next, frames) - start : count;
+                const int64_t until = clamp<int64_t>(at, from, count);
+                const int64_t chunks = _submixes.size();
+
+                _segment = {start, from, until};
+
+                if (from < until and _team.size() > 1L and
+                    _active() >= parallel)
+                    _team.run(chunks, _task);
+                else if (from < until)
+                    for (int64_t chunk = 0; chunk < chunks; ++chunk)
+                        _chunk(chunk);
+
+                from = until;
+
+                if (!_next or at >= count)
+                    break;
+
+                if (_stamped < int64_t(_stamps.size()))
+                    _stamps[_stamped++] =
+                        _next->time - (start + from) * 1e9L / _rate;
+
+                _apply(*_next);
+                _next = nullptr;
+            }
+
+            fill(_mix.begin() + _delay, _mix.begin() + _delay + count, 0.0f);
+
+            for (const auto &submix : _submixes)
+                _mixer.sum(_mix.data() + _delay, submix.data(), count);
+
+            limited = _pack(out + start, count, start, frames, volume) or
+                      limited;
+        }
+
+        if (limited)
+            telemetry.limited.fetch_add(1UL, memory_order_relaxed);
+
+        for (auto &part : _parts) {
+            part.blend = min(part.origin + frames * part.fade, 1.0f);
+
+            if (part.previous and part.blend >= 1.0f) {
+                part.previous = nullptr;
+                part.fading.store(nullptr, memory_order_release);
+            }
+        }
+    }
+
+    // Renders the voices of one chunk through the current segment into
+    // the chunk's sub-mix, stepping their envelopes as it goes; no two
+    // chunks share a voice, so any thread may take any chunk.
+    void _chunk(const int64_t chunk) {
+        const auto [start, from, until] = _segment;
+        const int64_t begin = chunk * grain;
+        const int64_t end = min<int64_t>(begin + grain, _voices.size());
+        float *mix = _submixes[chunk].data();
+
+        for (int64_t step = from; step < until; step += control) {
+            const int64_t stop = min(step + control, until);
+
+            _advance(begin, end, stop - step);
+
+            for (int64_t v = begin; v < end; ++v)
+                if (_voices[v].isActive() and
+                    _parts[_voices[v].part].current)
+                    _play(v, step, stop, start, mix);
+
+            _settle(begin, end);
+        }
+    }
+
+    // Converts count samples of the mix, from start in a render of frames,
+    // to samples in out. The gain ramps from the last render's volume to
+    // this one's over the render, less the headroom. The limiter bounds
+    // it over each control step by what keeps the step's peak under the
+    // ceiling, and moves from step to step in ramps that reach every
+    // bound by the start of its step, so the mix is turned down ahead of
+    // a peak rather than jumping at it; it comes back up by a factor of e
+    // every recovery seconds. While limiting, the mix is held back by one
+    // control step, which the front of _mix carries from one call to the
+    // next, so that the last step of a block already ramps toward the
+    // bound of the first step of the next; without the limiter nothing is
+    // held back. Returns whether it turned anything down.
+    bool _pack(int_osc_t *out, const int64_t count, const int64_t start,
+               const int64_t frames, const float volume) {
+        const int64_t steps = (count + control - 1L) / control;
+        const float headroom = pow(10.0f, -_dynamics.headroom / 20.0f);
+        const float ceiling = maxAmp * pow(10.0f, _dynamics.ceiling / 20.0f);
+        const float growth =
+            exp(control / max(_dynamics.recovery * float(_rate), 1.0f));
+        bool limited = false;
+
+        auto level = [&](const int64_t i) {
+            return headroom *
+                   (volume + (_gain - volume) * float(start + i) / frames);
+        };
+
+        for (int64_t k = 0; k <= steps; ++k) {
+            const int64_t step = min(k * control, count);
+            const int64_t stop = k < steps ? min(step + control, count)
+                                           : count + _delay;
+            const float peak =
+                _dynamics.limit
+                    ? _mixer.peak(_mix.data() + step, stop - step) *
+                          max(level(step), level(min(stop, count)))
+                    : 0.0f;
+
+            _bounds[k] = peak > ceiling ? ceiling / peak : 1.0f;
+        }
+
+        _limit = min(_limit, _bounds[0]);
+
+        for (int64_t k = 0; k < steps; ++k) {
+            const int64_t step = k * control;
+            const int64_t stop = min(step + control, count);
+            const float next =
+                min({_limit * growth, 1.0f, _bounds[k], _bounds[k + 1L]});
+            const float from = level(step) * _limit;
+            const float to = level(stop) * next;
+            const int64_t clipped =
+                _mixer.pack(_mix.data() + step, out + step, stop - step,
+                            from, (to - from) / (stop - step));
+
+            if (clipped > 0L)
+                telemetry.clipped.fetch_add(clipped, memory_order_relaxed);
+
+            limited = limited or _limit < 1.0f or next < 1.0f;
+            _limit = next;
+        }
+
+        copy(_mix.begin() + count, _mix.begin() + count + _delay,
+             _mix.begin());
+
+        return limited;
+    }
+
+    int64_t _active() const {
+        int64_t active = 0;
+
+        for (const auto &voice : _voices)
+            active += voice.isActive();
+
+        return active;
+    }
+
+    // Picks up the mipmap last passed to use() for each part once no fade
+    // is running in it. The outgoing one is published as fading before
+    // the new one as playing, and uses() reads them the other way round,
+    // so that it never misses a mipmap on its way from one to the other.
+    void _switch() {
+        for (auto &part : _parts) {
+            const Mipmap *mipmap = part.mipmap.load(memory_order_acquire);
+
+            if (part.previous or mipmap == part.current)
+                continue;
+
+            part.previous = part.current;
+            part.current = mipmap;
+            part.blend = part.previous ? 0.0f : 1.0f;
+            part.fade = 1.0f / max(_glide.load(memory_order_relaxed) *
+                                       float(_rate),
+                                   1.0f);
+            part.fading.store(part.previous, memory_order_release);
+            part.playing.store(part.current, memory_order_release);
+        }
+    }
+
+    // Counts an xrun when the audio handed over by the previous renders
+    // had already run out by the time this one started.
+    void _measure(const int64_t begun, const int64_t frames) {
+        const int64_t done = now();
+        const int64_t length = frames * 1e9L / _rate;
+
+        telemetry.render.record(done - begun);
+        telemetry.deadline.store(length, memory_order_relaxed);
+        telemetry.blocks.fetch_add(1UL, memory_order_relaxed);
+
+        if (done - begun > length)
+            telemetry.overruns.fetch_add(1UL, memory_order_relaxed);
+
+        if (_playout != 0L and begun > _playout)
+            telemetry.xruns.fetch_add(1UL, memory_order_relaxed);
+
+        _playout = max(_playout, begun) + length;
+
+        for (int64_t i = 0; i < _stamped; ++i)
+            telemetry.latency.record(done - _stamps[i] +
+                                     int64_t(_delay * 1e9L / _rate));
+
+        _stamped = 0L;
+    }
+
+    void _post(const NoteEvent &event) {
+        if (!_events.push(event)) {
+            telemetry.dropped.fetch_add(1UL, memory_order_relaxed);
+            return;
+        }
+
+        const int64_t depth = _events.size();
+        int64_t peak = telemetry.queued.load(memory_order_relaxed);
+
+        while (peak < depth and !telemetry.queued.compare_exchange_weak(
+                                    peak, depth, memory_order_relaxed))
+            ;
+    }
+
+    // The event's sample within this render: its distance from the
+    // previous render, clamped to the frames at hand.
+    int64_t _offset(const NoteEvent &event, const int64_t frames) const {
+        if (_last < 0L)
+            return 0L;
+
+        const float128_t delay = (event.time - _last) * _rate / 1e9L;
+
+        return clamp<int64_t>(round(delay), 0L, frames - 1L);
+    }
+
+    bool _isValid(const int64_t note, const int64_t part) const {
+        return note >= 0L and note < notes and part >= 0L and
+               part < getParts();
+    }
+
+    static int64_t _key(const int64_t note, const int64_t part) {
+        return part * notes + note;
+    }
+
+    void _apply(const NoteEvent &event) {
+        if (!_isValid(event.note, event.part))
+            return;
+
+        _sounding[_key(event.note, event.part)].store(
+            event.type == NoteEvent::On, memory_order_relaxed);
+
+        auto playing = [&event](const Voice &voice) {
+            return voice.note == event.note and voice.part == event.part;
+        };
+
+        if (event.type == NoteEvent::Off) {
+            for (size_t v = 0; v < _voices.size(); ++v)
+                if (playing(_voices[v]) and
+                    _voices[v].stage != Voice::Release)
+                    _stage(v, Voice::Release);
+
+            return;
+        }
+
+        auto rank = [](const Voice &voice) {
+            return !voice.isActive() ? 0 : voice.stage == Voice::Release ? 1 : 2;
+        };
+
+        size_t chosen = 0;
+
+        for (size_t v = 0; v < _voices.size(); ++v) {
+            if (playing(_voices[v])) {
+                chosen = v;
+                break;
+            }
+
+            const auto &voice = _voices[v];
+            const auto &best = _voices[chosen];
+
+            if (rank(voice) < rank(best) or
+                (rank(voice) == rank(best) and voice.age < best.age))
+                chosen = v;
+        }
+
+        auto &voice = _voices[chosen];
+
+        // A retriggered note keeps its phase and rises from its current
+        // level; a stolen voice starts over.
+        if (!playing(voice)) {
+            if (isActive(voice.note, voice.part) and rank(voice) == 2)
+                _sounding[_key(voice.note, voice.part)].store(
+                    false, memory_order_relaxed);
+
+            voice.phase = 0.0;
+            _levels[chosen] = 0.0f;
+        }
+
+        voice.note = event.note;
+        voice.part = event.part;
+        voice.freq = event.freq;
+        voice.gain = event.gain;
+        voice.age = ++_clock;
+        _stage(chosen, Voice::Attack);
+    }
+
+    // Points voice v's envelope at the end of stage.
+    void _stage(const size_t v, const Voice::Stage stage) {
+        auto samples = [this](const float seconds) {
+            return max(seconds * float(_rate), 1.0f);
+        };
+
+        _voices[v].stage = stage;
+
+        switch (stage) {
+            case Voice::Attack:
+                _targets[v] = 1.0f;
+                _slopes[v] = 1.0f / samples(_envelope.attack);
+                break;
+            case Voice::Decay:
+                _targets[v] = _envelope.sustain;
+                _slopes[v] =
+                    (_envelope.sustain - 1.0f) / samples(_envelope.decay);
+                break;
+            case Voice::Sustain:
+                _targets[v] = _levels[v];
+                _slopes[v] = 0.0f;
+                break;
+            case Voice::Release:
+                _targets[v] = 0.0f;
+                _slopes[v] = -_levels[v] / samples(_envelope.release);
+        }
+    }
+
+    // Moves the envelopes of voices [begin, end) count samples along their
+    // slopes, stopping at their targets. Branch-free over plain arrays, so
+    // that it vectorizes across voices; idle voices sit at zero with a
+    // zero slope.
+    void _advance(const int64_t begin, const int64_t end,
+                  const int64_t count) {
+        float *levels = _levels.data();
+        float *starts = _starts.data();
+        const float *slopes = _slopes.data();
+        const float *targets = _targets.data();
+
+        for (int64_t v = begin; v < end; ++v) {
+            const float level = levels[v] + slopes[v] * count;
+            const bool done =
+                slopes[v] > 0.0f ? level >= targets[v] : level <= targets[v];
+
+            starts[v] = levels[v];
+            levels[v] = done ? targets[v] : level;
+        }
+    }
+
+    // Moves the voices in [begin, end) whose envelopes reached their
+    // targets on to the next stage, and frees those that have fallen
+    // silent.
+    void _settle(const int64_t begin, const int64_t end) {
+        for (int64_t v = begin; v < end; ++v) {
+            auto &voice = _voices[v];
+
+            if (!voice.isActive() or _levels[v] != _targets[v] or
+                voice.stage == Voice::Sustain)
+                continue;
+
+            if (voice.stage != Voice::Attack and _levels[v] <= 0.0f) {
+                if (voice.stage != Voice::Release and
+                    isActive(voice.note, voice.part))
+                    _sounding[_key(voice.note, voice.part)].store(
+                        false, memory_order_relaxed);
+
+                voice = Voice();
+                _levels[v] = _slopes[v] = _targets[v] = 0.0f;
+            } else
+                _stage(v, voice.stage == Voice::Attack ? Voice::Decay
+                                                       : Voice::Sustain);
+        }
+    }
+
+    // Steps through voice v's level into mix, ramping its gain across the
+    // envelope step and, during a fade, its blend from the previous
+    // mipmap's level to the current one's. The blend follows from the
+    // step's place in the render, start + begin, so that every chunk
+    // computes it alike.
+    void _play(const int64_t v, const int64_t begin, const int64_t end,
+               const int64_t start, float *mix) {
+        auto &voice = _voices[v];
+        const auto &part = _parts[voice.part];
+        const float128_t freq = voice.freq * _ratio;
+        const auto &table = part.current->at(freq);
+        const double step = freq / part.current->rate;
+        const float ramp =
+            voice.gain * (_levels[v] - _starts[v]) / (end - begin);
+        float gain = voice.gain * _starts[v];
+        double phase = voice.phase;
+
+        if (part.previous) {
+            const auto &faded = part.previous->at(freq);
+            float blend =
+                min(part.origin + (start + begin) * part.fade, 1.0f);
+            const float slope =
+                (min(part.origin + (start + end) * part.fade, 1.0f) -
+                 blend) /
+                (end - begin);
+
+            for (int64_t i = begin; i < end; ++i) {
+                const float from = interpolate(faded, phase);
+                const float to = interpolate(table, phase);
+
+                gain += ramp;
+                blend += slope;
+                mix[i] += gain * (from + blend * (to - from));
+                phase += step;
+                phase -= phase >= 1.0 ? 1.0 : 0.0;
+            }
+        } else {
+            for (int64_t i = begin; i < end; ++i) {
+                gain += ramp;
+                mix[i] += gain * interpolate(table, phase);
+                phase += step;
+                phase -= phase >= 1.0 ? 1.0 : 0.0;
+            }
+        }
+
+        voice.phase = phase;
+    }
+
+    // A part's mipmaps: the one last passed to use(), the one sounding
+    // and the one it is fading from, with the fade's progress at the
+    // start of the render and at the end of the last.
+    struct Part {
+        atomic<const Mipmap *> mipmap = nullptr;
+        atomic<const Mipmap *> playing = nullptr;
+        atomic<const Mipmap *> fading = nullptr;
+        const Mipmap *current = nullptr;
+        const Mipmap *previous = nullptr;
+        float origin = 1.0f;
+        float blend = 1.0f;
+        float fade = 1.0f;
+    };
+
+    // The block offset and the samples of it the chunks render next.
+    struct Segment {
+        int64_t start;
+        int64_t from;
+        int64_t until;
+    };
+
+    constexpr static int64_t control = 32L;
+
+    float128_t _rate;
+
+    vector<Voice> _voices;
+
+    vector<float> _levels;
+
+    vector<float> _starts;
+
+    vector<float> _slopes;
+
+    vector<float> _targets;
+
+    // The mix of a block, after the step held back from the last one.
+    vector<float> _mix;
+
+    vector<vector<float>> _submixes;
+
+    // The limiter's bound on the gain over each control step of a block,
+    // and over the step it holds back.
+    vector<float> _bounds;
+
+    Team _team;
+
+    Segment _segment = {0L, 0L, 0L};
+
+    function<void(int64_t)> _task = [this](const int64_t chunk) {
+        _chunk(chunk);
+    };
+
+    Envelope _envelope;
+
+    float _ratio = 1.0f;
+
+    float _gain = 1.0f;
+
+    Mixer _mixer = mixer();
+
+    Dynamics _dynamics;
+
+    // The limiter's gain at the end of the last block.
+    float _limit = 1.0f;
+
+    // The samples held back at the front of _mix: control while limiting.
+    int64_t _delay = 0L;
+
+    atomic<float> _headroom = Dynamics().headroom;
+
+    atomic<float> _ceiling = Dynamics().ceiling;
+
+    atomic<float> _recovery = Dynamics().recovery;
+
+    atomic<bool> _limiting = Dynamics().limit;
+
+    atomic<float> _bend = 1.0f;
+
+    atomic<float> _volume = 1.0f;
+
+    atomic<float> _attack = Envelope().attack;
+
+    atomic<float> _decay = Envelope().decay;
+
+    atomic<float> _sustain = Envelope().sustain;
+
+    atomic<float> _release = Envelope().release;
+
+    vector<Part> _parts;
+
+    atomic<float> _glide = 0.05f;
+
+    Ring<NoteEvent, queue> _events;
+
+    NoteEvent _event;
+
+    NoteEvent *_next = nullptr;
+
+    int64_t _last = -1L;
+
+    int64_t _playout = 0L;
+
+    array<int64_t, 64> _stamps;
+
+    int64_t _stamped = 0L;
+
+    vector<atomic<bool>> _sounding;
+
+    uint64_t _clock = 0UL;
+};
+
+// Feeds the engine's blocks to the audio device, and to the recorder if
+// given one: each block is rendered into one of the recorder's, which is
+// submitted once the device asks for the next and so is done with it.
+class Stream : public SoundStream {
+public:
+    Stream(Engine &engine, const float128_t rate,
+           Recorder *recorder = nullptr)
+        : _engine(engine), _recorder(recorder), _buffer(engine.getBlock()) {
+        initialize(1, round(rate));
+    }
+
+    ~Stream() {
+        stop();
+
+        if (_recorder)
+            _recorder->submit();
+    }
+
+private:
+    bool onGetData(Chunk &data) override {
+        int_osc_t *out = nullptr;
+
+        if (_recorder) {
+            _recorder->submit();
+            out = _recorder->acquire();
+        }
+
+        out = out ? out : _buffer.data();
+        _engine.render(out, _buffer.size());
+        data.samples = out;
+        data.sampleCount = _buffer.size();
+        return true;
+    }
+
+    void onSeek(Time) override {}
+
+    Engine &_engine;
+
+    Recorder *_recorder;
+
+    vector<int_osc_t> _buffer;
+};
+
+// Plays the widest table of a mipmap over and over at a fixed frequency.
+// A mipmap passed to offer() takes over at the next upward zero crossing
+// of the output, and is entered at its own upward zero crossing, so that
+// the splice neither jumps nor reverses; a table that never rises through
+// zero is left at the end of its cycle. Until the swap the owner may
+// withdraw() the mipmap again. The audio thread only swaps a pointer,
+// and the mipmaps stay with the owner.
+class Loop : public SoundStream {
+public:
+    Loop(const float128_t freq, const float128_t rate,
+         const int64_t block = 256L)
+        : _step(freq / rate), _buffer(block) {
+        initialize(1, round(rate));
+    }
+
+    ~Loop() { stop(); }
+
+    void offer(const Mipmap &mipmap) {
+        _pending.store(&mipmap, memory_order_release);
+    }
+
+    // Whether the mipmap last offered was still pending, and is now free.
+    bool withdraw() {
+        return _pending.exchange(nullptr, memory_order_acq_rel) != nullptr;
+    }
+
+private:
+    bool onGetData(Chunk &data) override {
+        bool waiting = _pending.load(memory_order_relaxed) != nullptr;
+        bool wrapped = _table.empty();
+
+        for (auto &sample : _buffer) {
+            float value = _table.empty() ? 0.0f : interpolate(_table, _phase);
+            const bool rising = _last <= 0.0f and value > 0.0f;
+
+            if (waiting and (rising or (wrapped and _entry < 0.0))) {
+                const auto *mipmap =
+                    _pending.exchange(nullptr, memory_order_acq_rel);
+
+                if (mipmap) {
+                    _table = mipmap->levels[0];
+                    _entry = _crossing(_table);
+                    _phase = max(_entry, 0.0);
+                    value = interpolate(_table, _phase);
+                }
+
+                waiting = false;
+            }
+
+            sample = lrintf(value);
+            _last = value;
+            _phase += _step;
+            wrapped = _phase >= 1.0;
+            _phase -= wrapped ? 1.0 : 0.0;
+        }
+
+        data.samples = _buffer.data();
+        data.sampleCount = _buffer.size();
+        return true;
+    }
+
+    void onSeek(Time) override {}
+
+    // The phase at which table first rises through zero, counting the
+    // step from its last sample back to its first, or -1 if never.
+    static double _crossing(const span<const int_osc_t> table) {
+        const int64_t length = table.size();
+
+        for (int64_t i = 0; i < length; ++i) {
+            const double from = table[(i + length - 1L) % length];
+            const double to = table[i];
+
+            if (from <= 0.0 and to > 0.0)
+                return fmod(i + length - 1.0 + from / (from - to), length) /
+                       length;
+        }
+
+        return -1.0;
+    }
+
+    double _step;
+
+    double _phase = 0.0;
+
+    double _entry = -1.0;
+
+    float _last = 0.0f;
+
+    span<const int_osc_t> _table;
+
+    atomic<const Mipmap *> _pending = nullptr;
+
+    vector<int_osc_t> _buffer;
+};
+
+#endif
@@ -3,76 +3,95 @@
 
 #include <SFML/Audio.hpp>
 #include <SFML/Graphics.hpp>
+#include <array>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <optional>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "bank.cpp"
+#include "cache.cpp"
 #include "instrument.cpp"
+#include "kernel.cpp"
+#include "noise.cpp"
+#include "renderer.cpp"
+#include "spectrum.cpp"
+#include "voicing.cpp"
 #include "waveform.cpp"
 
 using namespace sf;
 using namespace std;
+using namespace std::chrono;
 using namespace synth;
 
+// Given a preset bank, starts from its first preset; Tab steps through
+// the presets, Shift+Tab back, and S adds the current sound to the bank
+// along with the organ's tables for it.
 class Frontend {
 public:
-    Frontend() {
+    Frontend(const float128_t rate = defaultRate,
+             PresetBank *bank = nullptr)
+        : _rate(rate), _bank(bank) {
         _icon.loadFromFile("./icon.png");
         _window.setIcon(_icon.getSize().x, _icon.getSize().y,
                         _icon.getPixelsPtr());
-        _body(_pipe.getWavetable());
-    }
 
-    BuildWavetable getWavetableBuilder() {
-        auto transform = _reverse ? reverseWaveform : identityWaveform;
-
-        switch (_select) {
-            case 0:
-                return variadic(transform(sineWaveform));
-            case 1:
-                return variadic(transform(triangleWaveform));
-            case 2:
-                return variadic(transform(triangleWaveformFourier(_approx)));
-            case 3:
-                return variadic(transform(squareWaveform(_division)));
-            case 4:
-                return variadic(transform(squareWaveformFourier(_approx)));
-            case 5:
-                return variadic(transform(sawtoothWaveform));
-            case 6:
-                return variadic(transform(sawtoothWaveformFourier(_approx)));
-            case 7:
-                return variadic(transform(sinePulseWaveform));
-            case 8:
-                return variadic(transform(sinePulseWaveformFourier(_approx)));
-            default:
-                return variadic(transform(randomNoise));
-        }
+        if (_bank and _bank->size() > 0L)
+            _choose(0L);
+        else
+            _body(_pipe.getWavetable());
     }
 
+    BuildWavetable getWavetableBuilder() const { return builderOf(_voicing); }
+
+    const Envelope &getEnvelope() const { return _shape; }
+
+    Patch getPatch() const { return patchOf(_voicing); }
+
+    // Sleeps in waitEvent() while there is nothing to do; otherwise polls
+    // every tick for a finished render or a ready organ. The window is
+    // redrawn only once something on it changed, at most framerate times
+    // a second, and continuously only while the telemetry overlay shows.
     void loop(Organ &organ) {
         auto event = Event();
 
         while (_window.isOpen()) {
-            while (_window.pollEvent(event)) {
+            bool waiting = !_dirty and !_stale and !_overlay and
+                           !_pending.valid();
+
+            while (waiting ? _window.waitEvent(event)
+                           : _window.pollEvent(event)) {
+                waiting = false;
+
                 if (event.type == Event::KeyPressed and
                     Keyboard::isKeyPressed(Keyboard::Up)) {
-                    _approx += 1L;
+                    _voicing.approx += 1L;
                     _update();
+                    _stale = true;
                 }
 
                 else if (event.type == Event::KeyPressed and
                          Keyboard::isKeyPressed(Keyboard::Down)) {
-                    if (_approx > 1)
-                        _approx -= 1;
+                    if (_voicing.approx > 1)
+                        _voicing.approx -= 1;
 
                     _update();
+                    _stale = true;
                 }
 
                 else if (event.type == Event::Closed)
                     _window.close();
 
+                else if (event.type == Event::Resized or
+                         event.type == Event::GainedFocus)
+                    _dirty = true;
+
                 else if (event.type == Event::KeyPressed and
                          Keyboard::isKeyPressed(Keyboard::R)) {
-                    _reverse = !_reverse;
+                    _voicing.reverse = !_voicing.reverse;
                     _update();
                 }
 
@@ -89,123 +108,386 @@ public:
 
                 else if (event.type == Event::KeyPressed and
                          Keyboard::isKeyPressed(Keyboard::Left)) {
-                    _select = _select > 1 ? _select - 1L : _choice - 1;
+                    _voicing.select = _voicing.select > 1
+                                          ? _voicing.select - 1L
+                                          : waveforms - 1;
                     _update();
                 }
 
                 else if (event.type == Event::KeyPressed and
                          Keyboard::isKeyPressed(Keyboard::Right)) {
-                    _select = (_select += 1L) % _choice;
+                    _voicing.select = (_voicing.select += 1L) % waveforms;
+                    _update();
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::Enter)) {
+                    organ.shape(getEnvelope());
+                    _stale = true;
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::E)) {
+                    _envelope = (_envelope + 1L) % _envelopes.size();
+                    _shape = _envelopes[_envelope];
+                    _head();
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::M)) {
+                    _voicing.derivation =
+                        _voicing.derivation == Derivation::Spectral
+                            ? Derivation::Resampled
+                            : Derivation::Spectral;
+                    _update();
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::V)) {
+                    _checking = !_checking;
+                    _asymmetry = nullopt;
+                    _check();
+                    _head();
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::T)) {
+                    _overlay = !_overlay;
+                    _dirty = true;
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::D)) {
+                    telemetry.dump("./telemetry.txt");
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::N)) {
+                    _voicing.seed = entropySeed();
                     _update();
                 }
 
                 else if (event.type == Event::KeyPressed and
-                         Keyboard::isKeyPressed(Keyboard::Enter))
-                    organ.create(getWavetableBuilder());
+                         Keyboard::isKeyPressed(Keyboard::P)) {
+                    _voicing.precision =
+                        _voicing.precision == Precision::Reference
+                            ? Precision::Double
+                        : _voicing.precision == Precision::Double
+                            ? Precision::Single
+                            : Precision::Reference;
+                    _update();
+                    _verify();
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::Tab) and _bank and
+                         _bank->size() > 0L) {
+                    const int64_t size = _bank->size();
+                    const int64_t step = event.key.shift ? size - 1L : 1L;
+
+                    _choose((_preset + step) % size);
+                    organ.shape(getEnvelope());
+                    _stale = true;
+                }
+
+                else if (event.type == Event::KeyPressed and
+                         Keyboard::isKeyPressed(Keyboard::S) and _bank) {
+                    _save();
+                }
 
                 else if (event.type == Event::KeyPressed and
                          Keyboard::isKeyPressed(Keyboard::A)) {
-                    if (_division > 0.0L)
-                        _division -= (1.0L / 128.0L);
+                    if (_voicing.division > 0.0L)
+                        _voicing.division -= (1.0L / 128.0L);
 
                     _update();
+                    _stale = true;
                 }
 
                 else if (event.type == Event::KeyPressed and
                          Keyboard::isKeyPressed(Keyboard::B)) {
-                    if (_division > 0.0L)
-                        _division += (1.0L / 128.0L);
+                    if (_voicing.division > 0.0L)
+                        _voicing.division += (1.0L / 128.0L);
 
                     _update();
+                    _stale = true;
                 }
             }
 
-            _window.clear();
-            _window.draw(&_chart[0], size_t(_width), LineStrip);
-            _window.display();
+            if (_pending.valid() and
+                _pending.wait_for(0s) == future_status::ready) {
+                _pending.get();
+                organ.commit();
+            }
+
+            if (_stale and !_pending.valid() and organ.isReady()) {
+                _stale = false;
+                _pending = organ.render(_renderer, getPatch());
+            }
+
+            const auto now = steady_clock::now();
+
+            if ((_dirty or _overlay) and now >= _frame and
+                _window.isOpen()) {
+                _window.clear();
+                _window.draw(_chart.data(), _chart.size(), Lines);
+
+                if (_overlay) {
+                    _graph();
+                    _window.draw(_bars.data(), _bars.size(), Lines);
+                }
+
+                _window.display();
+                _dirty = false;
+                _frame = now + std::chrono::microseconds(1000000L / _framerate);
+            } else if (_dirty or _stale or _overlay or _pending.valid())
+                this_thread::sleep_for(_tick);
         }
+
+        if (_pending.valid())
+            _pending.wait();
     }
 
 private:
     void _update() {
-        _pipe.create(getWavetableBuilder());
+        _deviation = nullopt;
+        _pipe.create(getPatch());
+        _check();
         _head();
         _body(_pipe.getWavetable());
     }
 
+    void _choose(const int64_t preset) {
+        const auto chosen = _bank->at(preset);
+        const auto known =
+            find(_envelopes.begin(), _envelopes.end(), chosen.envelope);
+
+        _preset = preset;
+        _voicing = chosen.voicing;
+        _shape = chosen.envelope;
+        _envelope =
+            known == _envelopes.end() ? -1L : known - _envelopes.begin();
+        _update();
+    }
+
+    // Builds the organ's tables for the current sound, from the cache
+    // when they are there, and stores them with it.
+    void _save() {
+        auto tables = Organ::createBank(_rate);
+
+        buildMipmap(tables, getPatch());
+
+        if (_bank->add({_voicing, _shape}, keyOf(_voicing), tables))
+            _preset = _bank->size() - 1L;
+        else
+            cerr << "Cannot save the preset" << endl;
+    }
+
+    constexpr static int64_t _framerate = 30L;
+    constexpr static std::chrono::milliseconds _tick = 10ms;
     constexpr static float128_t _repeat = 2.0L;
     constexpr static float128_t _cycle = 600.0L;
     constexpr static float128_t _width = _repeat * _cycle;
     constexpr static float128_t _height = 600.0L;
     constexpr static float128_t _screen = _height / 3.0L;
-    constexpr static int64_t _choice = 10;
+    constexpr static int64_t _lowest = 10L;
+    constexpr static int64_t _span = 20L;
+
+    // Organ, plucked and pad: attack, decay, sustain, release.
+    constexpr static array<Envelope, 3> _envelopes = {
+        Envelope{0.005f, 0.0f, 1.0f, 0.03f},
+        Envelope{0.002f, 1.2f, 0.0f, 0.3f},
+        Envelope{0.4f, 0.5f, 0.7f, 1.0f}
+    };
+
+    Renderer _renderer;
 
-    Pipe _pipe = Pipe(getWavetableBuilder());
+    future<void> _pending;
+
+    // The organ's tables lag the parameters: set by Enter, and by approx
+    // and division changes, which the organ follows while notes are held.
+    bool _stale = false;
+
+    float128_t _rate;
+
+    PresetBank *_bank;
+
+    int64_t _preset = 0L;
 
     RenderWindow _window = RenderWindow(VideoMode(1200, 600), "Synth - Sine");
 
     Image _icon;
 
-    Vertex _chart[size_t(_width)];
+    // Two vertices per column: the lowest and highest sample under it.
+    array<Vertex, 2 * size_t(_width)> _chart;
+
+    bool _dirty = true;
+
+    steady_clock::time_point _frame;
 
-    int64_t _approx = 1L;
+    optional<int64_t> _deviation;
 
-    float128_t _division = 0.5L;
+    int64_t _envelope = 0L;
 
-    bool _reverse = false;
+    Envelope _shape = _envelopes[0];
 
-    int64_t _select = 0L;
+    bool _checking = false;
 
-    void _body(const vector<int_osc_t> &table) {
-        for (int64_t i = 0; i < _repeat; ++i) {
-            for (int64_t xAxis = i * _cycle; xAxis < (1.0L + i) * _cycle;
-                 ++xAxis) {
-                float128_t yAxis =
-                    ((xAxis - i * _cycle) / _cycle) * freq2TPC(stdFreq);
-                _chart[xAxis] = Vertex(
-                    Vector2f(xAxis, -table[round(yAxis)] / (maxAmp / _screen) +
-                                        1.5L * _screen));
+    optional<int64_t> _asymmetry;
+
+    bool _overlay = false;
+
+    array<Vertex, 4 * _span + 4> _bars;
+
+    Voicing _voicing = {.seed = entropySeed()};
+
+    // Built from the members above, so it must come after them.
+    Pipe _pipe = Pipe(getPatch(), _rate);
+
+    // A min/max envelope of the table, a column per pixel, from integer
+    // sample ranges: every sample shows, however many share a column, and
+    // each column reaches the first sample of the next so the trace joins.
+    void _body(const span<const int_osc_t> table) {
+        const int64_t length = table.size();
+        const int64_t cycle = _cycle;
+        const float scale = -_screen / maxAmp;
+        const float middle = 1.5L * _screen;
+
+        for (int64_t x = 0; x < cycle; ++x) {
+            const int64_t begin = x * length / cycle;
+            const int64_t end = max((x + 1L) * length / cycle, begin + 1L);
+            int_osc_t low = table[begin];
+            int_osc_t high = low;
+
+            for (int64_t time = begin + 1L; time <= end; ++time) {
+                low = min(low, table[time % length]);
+                high = max(high, table[time % length]);
+            }
+
+            for (int64_t i = 0; i < _repeat; ++i) {
+                const float column = x + i * cycle;
+
+                _chart[2L * (x + i * cycle)] =
+                    Vertex(Vector2f(column, low * scale + middle));
+                _chart[2L * (x + i * cycle) + 1L] =
+                    Vertex(Vector2f(column, high * scale + middle));
             }
         }
+
+        _dirty = true;
     }
 
-    void _head() {
-        switch (_select) {
-            case 0:
-                _window.setTitle("Synth - Sine");
-                break;
-            case 1:
-                _window.setTitle("Synth - Triangle");
-                break;
-            case 2:
-                _window.setTitle("Synth - Triangle Fourier (approx = " +
-                                 to_string(_approx) + ")");
-                break;
-            case 3:
-                _window.setTitle(
-                    "Synth - Square (division = " + to_string(_division) + ")");
-                break;
-            case 4:
-                _window.setTitle("Synth - Square Fourier (approx = " +
-                                 to_string(_approx) + ")");
-                break;
-            case 5:
-                _window.setTitle("Synth - Sawtooth");
-                break;
-            case 6:
-                _window.setTitle("Synth - Sawtooth Fourier (approx = " +
-                                 to_string(_approx) + ")");
-                break;
-            case 7:
-                _window.setTitle("Synth - Sine Pulse");
-                break;
-            case 8:
-                _window.setTitle("Synth - Sine Pulse Fourier (approx = " +
-                                 to_string(_approx) + L")");
-                break;
-            default:
-                _window.setTitle("Synth - Random Noise");
+    // Latency (green) and block render time (yellow) histograms from 1 us
+    // to 1 s, a bucket per octave, under a red mark at the block deadline.
+    // The deepest the note event queue has been stands to the right, cyan
+    // while no event was dropped and red once one was.
+    void _graph() {
+        auto bar = [this](const Histogram &histogram, const int64_t bucket,
+                          const int64_t lane, const Color &color) {
+            uint64_t most = 1UL;
+
+            for (int64_t k = _lowest; k < _lowest + _span; ++k)
+                most = max(most, histogram.at(k));
+
+            const int64_t index = 4L * (bucket - _lowest) + 2L * lane;
+            const float x = 20.0f + 12.0f * (bucket - _lowest) + 4.0f * lane;
+            const float y =
+                100.0f * (1.0f - float(histogram.at(bucket)) / most) + 20.0f;
+
+            _bars[index] = Vertex(Vector2f(x, 120.0f), color);
+            _bars[index + 1L] = Vertex(Vector2f(x, y), color);
+        };
+
+        for (int64_t k = _lowest; k < _lowest + _span; ++k) {
+            bar(telemetry.latency, k, 0L, Color::Green);
+            bar(telemetry.render, k, 1L, Color::Yellow);
         }
+
+        const float deadline =
+            20.0f + 12.0f * (log2(float(telemetry.deadline.load(
+                                 memory_order_relaxed))) -
+                             _lowest + 1.0f);
+
+        _bars[4 * _span] = Vertex(Vector2f(deadline, 10.0f), Color::Red);
+        _bars[4 * _span + 1] = Vertex(Vector2f(deadline, 130.0f), Color::Red);
+
+        const float queued = telemetry.queued.load(memory_order_relaxed);
+        const float x = 28.0f + 12.0f * _span;
+        const float y = 100.0f * (1.0f - queued / Engine::queue) + 20.0f;
+        const auto color = telemetry.dropped.load(memory_order_relaxed)
+                               ? Color::Red
+                               : Color::Cyan;
+
+        _bars[4 * _span + 2] = Vertex(Vector2f(x, 120.0f), color);
+        _bars[4 * _span + 3] = Vertex(Vector2f(x, y), color);
+    }
+
+    void _head() {
+        auto title = String("Synth - " + waveformName(_voicing.select));
+
+        if (_voicing.select == 3)
+            title += " (division = " + to_string(_voicing.division) + ")";
+        else if (_voicing.select == 2 or _voicing.select == 4 or
+                 _voicing.select == 6 or _voicing.select == 8)
+            title += " (approx = " + to_string(_voicing.approx) + ")";
+
+        if (_voicing.precision == Precision::Double)
+            title += " (double)";
+        else if (_voicing.precision == Precision::Single)
+            title += " (float)";
+
+        if (_voicing.derivation == Derivation::Resampled)
+            title += " (resampled)";
+
+        if (_envelope == 1L)
+            title += " (plucked)";
+        else if (_envelope == 2L)
+            title += " (pad)";
+
+        if (_asymmetry)
+            title += " (" + to_string(*_asymmetry) + " LSB from variadic)";
+
+        if (_deviation)
+            title += " (" + to_string(*_deviation) + " LSB from reference)";
+
+        _window.setTitle(title);
+    }
+
+    // While checking, builds the current waveform again without using its
+    // symmetry, over an even and an odd cycle, and records how far the
+    // mirrored build strays from it.
+    void _check() {
+        if (!_checking)
+            return;
+
+        const auto build = getWavetableBuilder();
+        const auto mirror = exchange(_voicing.mirror, false);
+        const auto reference = getWavetableBuilder();
+
+        _voicing.mirror = mirror;
+        _asymmetry = max(symmetryError(build, reference, cycleLength),
+                         symmetryError(build, reference, cycleLength - 1L));
+    }
+
+    // Renders the current cycle again in long double and records how far
+    // the current precision strays from it.
+    void _verify() {
+        if (_voicing.precision == Precision::Reference)
+            return;
+
+        const auto table = renderCycle(getWavetableBuilder());
+        const auto precision =
+            exchange(_voicing.precision, Precision::Reference);
+        const auto reference = renderCycle(getWavetableBuilder());
+
+        _voicing.precision = precision;
+        _deviation = 0L;
+
+        for (size_t time = 0; time < table.size(); ++time)
+            _deviation = max<int64_t>(*_deviation,
+                                      abs(table[time] - reference[time]));
+
+        _head();
     }
 };
 
@@ -2,106 +2,254 @@
 #define INSTRUMENT
 
 #include <SFML/Audio.hpp>
+#include "cache.cpp"
+#include "engine.cpp"
+#include "partials.cpp"
+#include "renderer.cpp"
+#include "resample.cpp"
+#include "telemetry.cpp"
 #include "waveform.cpp"
+#include "wavetable.cpp"
+#include <optional>
 
 using namespace sf;
 using namespace std;
 using namespace synth;
 
+// Fills mipmap from the table cache, or builds it and caches the result.
+// Spectral builds of additive patches go through partials when given, and
+// builds work in scratch when given, else in buffers of their own;
+// additive patches are synthesized from their spectrum there rather than
+// through their builder, which would allocate its own.
+void buildMipmap(Mipmap &mipmap, const Patch &patch,
+                 Partials *partials = nullptr, Scratch *scratch = nullptr) {
+    auto stopwatch = Stopwatch(telemetry.build(patch.name));
+
+    if (tableCache.load(patch.key, mipmap))
+        return;
+
+    auto own = optional<Scratch>();
+
+    if (!scratch)
+        scratch = &own.emplace(mipmap, oversample);
+
+    const bool additive = patch.spectrum.harmonics() > 0L;
+
+    if (patch.key.derivation == Derivation::Resampled and additive)
+        resampleMipmap(mipmap, patch.spectrum, *scratch);
+    else if (patch.key.derivation == Derivation::Resampled)
+        resampleMipmap(mipmap, patch.build, *scratch);
+    else if (partials and additive)
+        partials->retune(patch.spectrum, mipmap);
+    else if (additive)
+        renderMipmap(mipmap, patch.spectrum, *scratch);
+    else
+        renderMipmap(mipmap, patch.build, *scratch);
+
+    tableCache.store(patch.key, mipmap);
+}
+
+// Plays one or more patches layered over the whole MIDI range. Each
+// layer has three banks: the engine may still be fading out of one while
+// another sounds, and the third takes the next build. Only one render
+// per layer may be in flight, and only while isReady(); it works in the
+// layer's own scratch, so a patch change does not allocate. A bank is one
+// mipmap over all 128 notes, so memory stays the same however many keys
+// are played, and the engine's voice pool bounds the work however many
+// are held. Given a sink, the organ also records what it plays there.
 class Organ {
 public:
-    Organ(BuildWavetable build) {
-        for (int64_t i = 0; i < scale; ++i) {
-            table[i] = vector<int_osc_t>(round(freq2TPC(temperament[i])));
-        }
-        
-        create(build);
+    Organ(const Patch &patch, const float128_t rate = defaultRate,
+          const int64_t voices = 16L, const int64_t block = 256L)
+        : Organ(vector<Patch>{patch}, rate, voices, block) {}
+
+    Organ(const vector<Patch> &patches, const float128_t rate = defaultRate,
+          const int64_t voices = 16L, const int64_t block = 256L,
+          const int64_t threads = 1L, unique_ptr<Sink> sink = nullptr)
+        : recorder(sink ? make_unique<Recorder>(move(sink), block) : nullptr),
+          engine(rate, voices, block, max<int64_t>(patches.size(), 1L),
+                 threads),
+          stream(engine, rate, recorder.get()) {
+        layers.reserve(engine.getParts());
+
+        for (int64_t layer = 0; layer < engine.getParts(); ++layer)
+            layers.emplace_back(rate);
+
+        for (int64_t layer = 0; layer < int64_t(patches.size()); ++layer)
+            create(patches[layer], layer);
+
+        stream.play();
     }
 
-    void create(BuildWavetable build) {
-        for (int64_t i = 0; i < scale; ++i)
-            build(table[i], temperament[i], maxAmp);
+    void create(const Patch &patch, const int64_t layer = 0L) {
+        auto &at = layers[layer];
 
-        for (int64_t i = 0; i < scale; ++i)
-            buffer[i].loadFromSamples(&table[i][0], table[i].size(), 1,
-                                      stdRate);
+        buildMipmap(at.bank[at.back()], patch, &at.partials, &at.scratch);
+        commit(layer);
+    }
+
+    // Renders the next set of tables into the layer's back bank while the
+    // front one keeps sounding; commit it once the future is ready, and
+    // the engine fades over to it.
+    future<void> render(Renderer &renderer, Patch patch,
+                        const int64_t layer = 0L) {
+        return renderer.run([this, patch, layer]() {
+            auto &at = layers[layer];
+
+            buildMipmap(at.bank[at.back()], patch, &at.partials,
+                        &at.scratch);
+        });
+    }
+
+    void commit(const int64_t layer = 0L) {
+        auto &at = layers[layer];
+
+        at.front = at.back();
+        engine.use(at.bank[at.front], layer);
+    }
+
+    // Whether the layer's back bank is free of the engine's last fade.
+    bool isReady(const int64_t layer = 0L) const {
+        const auto &at = layers[layer];
+
+        return !engine.uses(at.bank[at.back()]);
+    }
 
-        for (int64_t i = 0; i < scale; ++i) {
-            sound[i].setBuffer(buffer[i]);
-            sound[i].setLoop(true);
-            sound[i].setVolume(0);
-            sound[i].play();
-        }
+    // Every layer sounds the note, from the same sample.
+    bool noteOn(int64_t note, float128_t velocity) {
+        const int64_t time = Engine::now();
+
+        if (!isNote(note))
+            return false;
+
+        for (int64_t layer = 0; layer < getLayers(); ++layer)
+            engine.noteOn(note, getFrequency(note), velocity, time, layer);
+
+        return true;
     }
 
-    const vector<int_osc_t> &getWavetable(int64_t note) {
-        return table[note + shift];
+    bool noteOff(int64_t note) {
+        const int64_t time = Engine::now();
+
+        if (!isNote(note))
+            return false;
+
+        for (int64_t layer = 0; layer < getLayers(); ++layer)
+            engine.noteOff(note, time, layer);
+
+        return true;
     }
 
-    void play(int64_t note) { sound[note + shift].play(); }
+    void bend(float128_t ratio) { engine.bend(ratio); }
+
+    void setVolume(float128_t volume) { engine.setVolume(volume); }
+
+    void shape(const Envelope &envelope) { engine.shape(envelope); }
+
+    void limit(const Dynamics &dynamics) { engine.limit(dynamics); }
 
-    void stop(int64_t note) { sound[note + shift].stop(); }
+    void glide(const float seconds) { engine.glide(seconds); }
 
     bool isActive(int64_t note) {
-        return sound[note + shift].getStatus() == SoundSource::Status::Playing;
+        for (int64_t layer = 0; layer < getLayers(); ++layer)
+            if (engine.isActive(note, layer))
+                return true;
+
+        return false;
     }
 
-    void setVolume(int64_t note, float128_t volume) {
-        sound[note + shift].setVolume(volume);
+    int64_t getLayers() const { return layers.size(); }
+
+    constexpr static bool isNote(int64_t note) {
+        return note >= 0L and note < keys;
     }
 
-    consteval static int64_t getShift() { return shift; }
+    consteval static int64_t getKeys() { return keys; }
+
+    // Equal temperament with A4, MIDI note 69, at 440 Hz.
+    static float128_t getFrequency(int64_t note) {
+        return 440.0L * exp2((note - 69L) / 12.0L);
+    }
+
+    // An empty bank: a mipmap over every key.
+    static Mipmap createBank(const float128_t rate) {
+        return Mipmap(getFrequency(0L), getFrequency(keys - 1L), rate);
+    }
 
 private:
-    constexpr static int64_t shift = -36;
-    constexpr static int64_t scale = 49L;
-
-    constexpr static float128_t temperament[scale] = {
-        65.4064, 69.2957, 73.4162, 77.7817, 82.4069, 87.3071, 92.4986,
-        97.9989, 103.826, 110.000, 116.541, 123.471, 130.813, 138.591,
-        146.832, 155.563, 164.814, 174.614, 184.997, 195.998, 207.652,
-        220.000, 233.082, 246.942, 261.626, 277.183, 293.665, 311.127,
-        329.628, 349.228, 369.994, 391.995, 415.305, 440.000, 466.164,
-        493.883, 523.251, 554.365, 587.330, 622.254, 659.255, 698.456,
-        739.989, 783.991, 830.609, 880.000, 932.328, 987.767, 1046.50
+    constexpr static int64_t keys = Engine::notes;
+
+    struct Layer {
+        Layer(const float128_t rate)
+            : bank{createBank(rate), createBank(rate), createBank(rate)},
+              partials(bank[0]), scratch(bank[0], oversample) {}
+
+        int64_t back() const { return (front + 1L) % 3L; }
+
+        Mipmap bank[3];
+
+        int64_t front = 0;
+
+        Partials partials;
+
+        Scratch scratch;
     };
 
-    vector<int_osc_t> table[scale];
+    vector<Layer> layers;
+
+    unique_ptr<Recorder> recorder;
 
-    SoundBuffer buffer[scale];
+    Engine engine;
 
-    Sound sound[scale];
+    Stream stream;
 };
 
+// Two tables, both allocated up front: the loop plays one while the other
+// is rebuilt, then takes the new one over at a zero crossing. Each has a
+// single level, whose top is stdFreq, so it is band-limited for the pipe's
+// own pitch.
 class Pipe {
 public:
-    Pipe(BuildWavetable build) { create(build); }
+    Pipe(const Patch &patch, const float128_t rate = defaultRate)
+        : table{Mipmap(stdFreq / 2.0L, stdFreq / 2.0L, rate),
+                Mipmap(stdFreq / 2.0L, stdFreq / 2.0L, rate)},
+          scratch(table[0], oversample), loop(stdFreq, rate) {
+        create(patch);
+    }
+
+    // Builds over the table offered last if the loop has not taken it
+    // yet, and over the one it left behind otherwise.
+    void create(const Patch &patch) {
+        if (offered and !loop.withdraw())
+            back = 1 - back;
 
-    void create(BuildWavetable build) {
-        build(table, stdFreq, maxAmp);
-        buffer.loadFromSamples(&table[0], table.size(), 1, stdRate);
-        sound.setBuffer(buffer);
-        sound.setLoop(true);
+        buildMipmap(table[back], patch, nullptr, &scratch);
+        loop.offer(table[back]);
+        offered = true;
     }
 
-    const vector<int_osc_t> &getWavetable() { return table; }
+    span<const int_osc_t> getWavetable() { return table[back].levels[0]; }
 
-    void play() { sound.play(); }
+    void play() { loop.play(); }
 
-    void stop() { sound.stop(); }
+    void stop() { loop.stop(); }
 
     bool isActive() {
-        return sound.getStatus() == SoundSource::Status::Playing;
+        return loop.getStatus() == SoundSource::Status::Playing;
     }
 
-    void setVolume(int64_t note, float128_t volume) { sound.setVolume(volume); }
+    void setVolume(int64_t note, float128_t volume) { loop.setVolume(volume); }
 
 private:
-    vector<int_osc_t> table = vector<int_osc_t>(round(freq2TPC(stdFreq)));
+    Mipmap table[2];
+
+    int64_t back = 0;
+
+    bool offered = false;
 
-    SoundBuffer buffer = SoundBuffer();
+    Scratch scratch;
 
-    Sound sound = Sound();
+    Loop loop;
 };
 
 #endif
@@ -0,0 +1,251 @@
+#if !defined(KERNEL)
+#define KERNEL
+
+#include "waveform.cpp"
+#include <cstdint>
+#include <optional>
+
+namespace synth {
+    using namespace std;
+
+    // Reference evaluates the waveforms themselves in long double; Double
+    // and Single evaluate vectorized polynomial kernels of the same shapes.
+    enum class Precision { Reference, Double, Single };
+
+    struct Kernel {
+        enum Shape { Sine, Triangle, Sawtooth, Square, SinePulse };
+
+        Shape shape;
+        float128_t division = 0.5L;
+        float128_t gain = 1.0L;
+    };
+
+    Kernel reverseWaveform(Kernel kernel) {
+        kernel.gain = -kernel.gain;
+        return kernel;
+    }
+
+    Kernel identityWaveform(Kernel kernel) { return kernel; }
+
+    // 512 bits of Real, and as many int32_t, in GCC's portable vector
+    // types; targets without AVX-512 split them into narrower registers.
+    template <class Real> struct Lanes {
+        typedef Real type __attribute__((vector_size(64)));
+        typedef int32_t index
+            __attribute__((vector_size(64 / sizeof(Real) * sizeof(int32_t))));
+    };
+
+    template <class Real> using lanes_t = typename Lanes<Real>::type;
+
+    template <class Real> using index_t = typename Lanes<Real>::index;
+
+    // The lane helpers work in place: returning GCC vectors wider than
+    // the baseline registers would change the ABI of non-inlined calls.
+    template <class Real>
+    [[gnu::always_inline]] inline void floorLanes(lanes_t<Real> &value) {
+        const auto whole = __builtin_convertvector(
+            __builtin_convertvector(value, index_t<Real>), lanes_t<Real>);
+
+        value = whole > value ? whole - Real(1) : whole;
+    }
+
+    // Reduces a phase in cycles to [-0.25, 0.25], where sin(twoPi * phase)
+    // keeps its value.
+    template <class Real>
+    [[gnu::always_inline]] inline void foldLanes(lanes_t<Real> &phase) {
+        lanes_t<Real> whole = phase + Real(0.5);
+
+        floorLanes<Real>(whole);
+        phase -= whole;
+        phase = phase > Real(0.25) ? Real(0.5) - phase : phase;
+        phase = phase < Real(-0.25) ? Real(-0.5) - phase : phase;
+    }
+
+    // Taylor series of sin(twoPi * phase) for a folded phase, to within
+    // 6e-8 in float and 6e-12 in double.
+    template <class Real>
+    [[gnu::always_inline]] inline void sineLanes(lanes_t<Real> &phase) {
+        constexpr int64_t terms = sizeof(Real) == sizeof(float) ? 5L : 7L;
+        const lanes_t<Real> angle = phase * Real(twoPi);
+        const lanes_t<Real> square = angle * angle;
+        lanes_t<Real> sum = {};
+
+        for (int64_t i = terms; i > 0L; --i)
+            sum = Real(1) - sum * square * Real(1.0L / (4L * i * i + 2L * i));
+
+        phase = angle * sum;
+    }
+
+    template <class Real, Kernel::Shape shape>
+    [[gnu::always_inline]] inline void
+    fillLanes(const Kernel &kernel, int_osc_t *table, const int64_t begin,
+              const int64_t end, const float128_t freq, const float128_t amp) {
+        using lanes = lanes_t<Real>;
+        constexpr int64_t width = sizeof(lanes) / sizeof(Real);
+
+        const float128_t tpc = freq2TPC(freq);
+        const Real cycle = freq2Cycle(freq);
+        const Real period = tpc;
+        const Real reciprocal = 1.0L / tpc;
+        const Real wrap = tpc + 1.0L;
+        const Real edge = ceil(kernel.division * tpc);
+        const Real gain = amp * kernel.gain;
+
+        lanes offset;
+
+        for (int64_t i = 0; i < width; ++i)
+            offset[i] = i;
+
+        for (int64_t start = begin; start < end; start += width) {
+            const lanes time = offset + Real(start);
+            lanes value = time * cycle;
+
+            if constexpr (shape == Kernel::Sine) {
+                foldLanes<Real>(value);
+                sineLanes<Real>(value);
+            } else if constexpr (shape == Kernel::Triangle) {
+                foldLanes<Real>(value);
+                value *= Real(4);
+            } else if constexpr (shape == Kernel::Sawtooth) {
+                lanes cycles = time * reciprocal;
+
+                floorLanes<Real>(cycles);
+                value = Real(1) - Real(2) * cycle * (time - period * cycles);
+            } else if constexpr (shape == Kernel::Square) {
+                lanes cycles = time / wrap;
+
+                floorLanes<Real>(cycles);
+                value = time - wrap * cycles < edge ? Real(1) : Real(-1);
+            } else {
+                value *= Real(0.5);
+                foldLanes<Real>(value);
+                sineLanes<Real>(value);
+                value = Real(2) * (value < Real(0) ? -value : value) - Real(1);
+            }
+
+            value *= gain;
+            value += value < Real(0) ? Real(-0.5) : Real(0.5);
+
+            const auto rounded = __builtin_convertvector(value, index_t<Real>);
+
+            if (end - start >= width)
+                for (int64_t i = 0; i < width; ++i)
+                    table[start + i] = rounded[i];
+            else
+                for (int64_t i = 0; i < end - start; ++i)
+                    table[start + i] = rounded[i];
+        }
+    }
+
+    using FillLanes = void (*)(const Kernel &, int_osc_t *, const int64_t,
+                               const int64_t, const float128_t,
+                               const float128_t);
+
+    template <class Real, Kernel::Shape shape>
+    [[gnu::target("avx512f,avx512bw,avx512dq")]] void
+    fillAVX512(const Kernel &kernel, int_osc_t *table, const int64_t begin,
+               const int64_t end, const float128_t freq, const float128_t amp) {
+        fillLanes<Real, shape>(kernel, table, begin, end, freq, amp);
+    }
+
+    template <class Real, Kernel::Shape shape>
+    [[gnu::target("avx2,fma")]] void
+    fillAVX2(const Kernel &kernel, int_osc_t *table, const int64_t begin,
+             const int64_t end, const float128_t freq, const float128_t amp) {
+        fillLanes<Real, shape>(kernel, table, begin, end, freq, amp);
+    }
+
+    template <class Real, Kernel::Shape shape>
+    void fillGeneric(const Kernel &kernel, int_osc_t *table,
+                     const int64_t begin, const int64_t end,
+                     const float128_t freq, const float128_t amp) {
+        fillLanes<Real, shape>(kernel, table, begin, end, freq, amp);
+    }
+
+    const char *simdTarget() {
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f") and
+            __builtin_cpu_supports("avx512bw") and
+            __builtin_cpu_supports("avx512dq"))
+            return "avx512";
+
+        if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+            return "avx2";
+
+        return "generic";
+    }
+
+    template <class Real, Kernel::Shape shape> FillLanes dispatch() {
+        const static string target = simdTarget();
+
+        if (target == "avx512")
+            return fillAVX512<Real, shape>;
+
+        if (target == "avx2")
+            return fillAVX2<Real, shape>;
+
+        return fillGeneric<Real, shape>;
+    }
+
+    template <class Real> FillLanes dispatch(const Kernel::Shape shape) {
+        switch (shape) {
+            case Kernel::Sine:
+                return dispatch<Real, Kernel::Sine>();
+            case Kernel::Triangle:
+                return dispatch<Real, Kernel::Triangle>();
+            case Kernel::Sawtooth:
+                return dispatch<Real, Kernel::Sawtooth>();
+            case Kernel::Square:
+                return dispatch<Real, Kernel::Square>();
+            default:
+                return dispatch<Real, Kernel::SinePulse>();
+        }
+    }
+
+    FillWavetable vectorize(const Kernel kernel, const Precision precision) {
+        const FillLanes fill = precision == Precision::Single
+                                   ? dispatch<float>(kernel.shape)
+                                   : dispatch<double>(kernel.shape);
+
+        return [kernel, fill](vector<int_osc_t> &table, const float128_t freq,
+                              const float128_t amp, const int64_t begin,
+                              const int64_t end) {
+            fill(kernel, table.data(), begin, end, freq, amp);
+        };
+    }
+
+    // Evaluates a waveform at the given precision, through its kernel when
+    // it has one and the precision asks for it.
+    template <class Apply>
+    FillWavetable evaluate(Apply apply, const optional<Kernel> kernel,
+                           const Precision precision) {
+        if (precision == Precision::Reference or !kernel)
+            return evaluate(apply);
+
+        return vectorize(*kernel, precision);
+    }
+
+    // Largest deviation, in LSB of int_osc_t, of the kernel at a precision
+    // from the long double waveform it stands for, over one table at freq.
+    template <class Apply>
+    int64_t precisionError(Apply apply, const Kernel kernel,
+                           const Precision precision,
+                           const float128_t freq = stdFreq) {
+        auto reference = vector<int_osc_t>(round(freq2TPC(freq)));
+        auto vectorized = vector<int_osc_t>(reference.size());
+        int64_t error = 0;
+
+        evaluate(apply)(reference, freq, maxAmp, 0L, reference.size());
+        evaluate(apply, kernel, precision)(vectorized, freq, maxAmp, 0L,
+                                           vectorized.size());
+
+        for (size_t time = 0; time < reference.size(); ++time)
+            error =
+                max<int64_t>(error, abs(reference[time] - vectorized[time]));
+
+        return error;
+    }
+}
+
+#endif
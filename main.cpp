@@ -1,18 +1,105 @@
+#include "bank.cpp"
+#include "cache.cpp"
 #include "frontend.cpp"
 #include "instrument.cpp"
 #include "sequencer.cpp"
+#include "telemetry.cpp"
 
 using namespace sf;
 using namespace std;
 using namespace synth;
 
-int main() {
-    static auto frontend = Frontend();
-    static auto organ = Organ(frontend.getWavetableBuilder());
-    static auto sequencer = Sequencer();
+int main(int argc, char **argv) {
+    auto rate = defaultRate;
+    auto report = string();
+    auto record = string();
+    auto sources = vector<string>();
+    auto layers = vector<int64_t>();
+    auto voices = 16L;
+    auto block = 256L;
+    auto output = string();
+    auto threads = 1L;
+    auto presets = string();
+    auto dynamics = Dynamics();
+    auto glide = 0.05f;
+    auto cache =
+        string(getenv("HOME") ? getenv("HOME") : ".") + "/.cache/synth";
+
+    for (int64_t i = 1; i < argc; ++i) {
+        const auto option = string(argv[i]);
+
+        if (option == "--rate" and i + 1 < argc)
+            rate = stold(argv[++i]);
+        else if (option == "--telemetry" and i + 1 < argc)
+            report = argv[++i];
+        else if (option == "--cache" and i + 1 < argc)
+            cache = argv[++i];
+        else if (option == "--record" and i + 1 < argc)
+            record = argv[++i];
+        else if (option == "--connect" and i + 1 < argc)
+            sources.push_back(argv[++i]);
+        else if (option == "--bank" and i + 1 < argc)
+            presets = argv[++i];
+        else if (option == "--output" and i + 1 < argc)
+            output = argv[++i];
+        else if (option == "--threads" and i + 1 < argc)
+            threads = max(stoll(argv[++i]), 1LL);
+        else if (option == "--voices" and i + 1 < argc)
+            voices = max(stoll(argv[++i]), 1LL);
+        else if (option == "--block" and i + 1 < argc)
+            block = max(stoll(argv[++i]), 1LL);
+        else if (option == "--headroom" and i + 1 < argc)
+            dynamics.headroom = stof(argv[++i]);
+        else if (option == "--glide" and i + 1 < argc)
+            glide = max(stof(argv[++i]), 0.0f);
+        else if (option == "--ceiling" and i + 1 < argc) {
+            if (!parseCeiling(argv[++i], dynamics)) {
+                cerr << "Ceiling takes decibels or off" << endl;
+                return 1;
+            }
+        } else if (option == "--layer" and i + 1 < argc) {
+            layers.push_back(parseWaveform(argv[++i]));
+
+            if (layers.back() < 0L) {
+                cerr << "Unknown waveform " << argv[i] << endl;
+                return 1;
+            }
+        }
+    }
+
+    if (!cache.empty() and !tableCache.open(cache))
+        cerr << "Cannot open table cache " << cache << endl;
+
+    static auto bank = PresetBank();
+    const bool banked = !presets.empty() and bank.open(presets);
+
+    if (!presets.empty() and !banked)
+        cerr << "Cannot read preset bank " << presets << endl;
+
+    if (banked)
+        tableCache.attach(&bank);
+
+    static auto frontend = Frontend(rate, banked ? &bank : nullptr);
+    auto patches = vector<Patch>{frontend.getPatch()};
+
+    for (const int64_t select : layers)
+        patches.push_back(patchOf({.select = select}));
+
+    static auto organ = Organ(patches, rate, voices, block, threads,
+                              output.empty() ? nullptr
+                                             : openSink(output, rate));
+
+    organ.shape(frontend.getEnvelope());
+    organ.limit(dynamics);
+    organ.glide(glide);
+    static auto sequencer = Sequencer(sources, record);
 
     sequencer.loop(organ);
     frontend.loop(organ);
+    sequencer.stop();
+
+    if (!report.empty() and !telemetry.dump(report))
+        cerr << "Cannot write telemetry to " << report << endl;
 
     return 0;
 }
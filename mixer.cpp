@@ -0,0 +1,175 @@
+#if !defined(MIXER)
+#define MIXER
+
+#include "kernel.cpp"
+#include "waveform.cpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace synth {
+    using namespace std;
+
+    // Adds count samples of submix into mix.
+    [[gnu::always_inline]] inline void sumLanes(float *mix,
+                                                const float *submix,
+                                                const int64_t count) {
+        for (int64_t i = 0; i < count; ++i)
+            mix[i] += submix[i];
+    }
+
+    // The largest magnitude among count samples of mix.
+    [[gnu::always_inline]] inline float peakLanes(const float *mix,
+                                                  const int64_t count) {
+        using lanes = lanes_t<float>;
+        constexpr int64_t width = sizeof(lanes) / sizeof(float);
+
+        lanes peaks = {};
+        float peak = 0.0f;
+        int64_t i = 0;
+
+        for (; i + width <= count; i += width) {
+            lanes value;
+
+            memcpy(&value, mix + i, sizeof(value));
+            value = value < 0.0f ? -value : value;
+            peaks = value > peaks ? value : peaks;
+        }
+
+        for (int64_t lane = 0; lane < width; ++lane)
+            peak = max(peak, peaks[lane]);
+
+        for (; i < count; ++i)
+            peak = max(peak, abs(mix[i]));
+
+        return peak;
+    }
+
+    // Scales count samples of mix by a gain that moves by slope each
+    // sample from gain, the first sample taking gain + slope, rounds them
+    // half away from zero and packs them into out, saturating at the
+    // limits of int_osc_t. Returns how many samples would have rounded
+    // past them.
+    [[gnu::always_inline]] inline int64_t
+    packLanes(const float *mix, int_osc_t *out, const int64_t count,
+              const float gain, const float slope) {
+        using lanes = lanes_t<float>;
+        using index = index_t<float>;
+        constexpr int64_t width = sizeof(lanes) / sizeof(float);
+        constexpr float lowest = numeric_limits<int_osc_t>::min();
+        constexpr float highest = numeric_limits<int_osc_t>::max();
+
+        lanes offset;
+        index clips = {};
+        int64_t clipped = 0;
+        int64_t i = 0;
+
+        for (int64_t lane = 0; lane < width; ++lane)
+            offset[lane] = lane + 1L;
+
+        for (; i + width <= count; i += width) {
+            lanes value;
+
+            memcpy(&value, mix + i, sizeof(value));
+            value *= gain + slope * (offset + float(i));
+            clips -= value <= lowest - 0.5f or value >= highest + 0.5f;
+            value = value < lowest ? lowest : value;
+            value = value > highest ? highest : value;
+            value += value < 0.0f ? -0.5f : 0.5f;
+
+            const auto rounded = __builtin_convertvector(value, index);
+
+            for (int64_t lane = 0; lane < width; ++lane)
+                out[i + lane] = rounded[lane];
+        }
+
+        for (int64_t lane = 0; lane < width; ++lane)
+            clipped += clips[lane];
+
+        for (; i < count; ++i) {
+            const float value = mix[i] * (gain + slope * (i + 1L));
+
+            clipped += value <= lowest - 0.5f or value >= highest + 0.5f;
+            out[i] = clamp(value, lowest, highest) +
+                     (value < 0.0f ? -0.5f : 0.5f);
+        }
+
+        return clipped;
+    }
+
+    using SumLanes = void (*)(float *, const float *, const int64_t);
+
+    using PeakLanes = float (*)(const float *, const int64_t);
+
+    using PackLanes = int64_t (*)(const float *, int_osc_t *, const int64_t,
+                                  const float, const float);
+
+    [[gnu::target("avx512f,avx512bw,avx512dq")]] void
+    sumAVX512(float *mix, const float *submix, const int64_t count) {
+        sumLanes(mix, submix, count);
+    }
+
+    [[gnu::target("avx512f,avx512bw,avx512dq")]] float
+    peakAVX512(const float *mix, const int64_t count) {
+        return peakLanes(mix, count);
+    }
+
+    [[gnu::target("avx512f,avx512bw,avx512dq")]] int64_t
+    packAVX512(const float *mix, int_osc_t *out, const int64_t count,
+               const float gain, const float slope) {
+        return packLanes(mix, out, count, gain, slope);
+    }
+
+    [[gnu::target("avx2,fma")]] void
+    sumAVX2(float *mix, const float *submix, const int64_t count) {
+        sumLanes(mix, submix, count);
+    }
+
+    [[gnu::target("avx2,fma")]] float peakAVX2(const float *mix,
+                                               const int64_t count) {
+        return peakLanes(mix, count);
+    }
+
+    [[gnu::target("avx2,fma")]] int64_t
+    packAVX2(const float *mix, int_osc_t *out, const int64_t count,
+             const float gain, const float slope) {
+        return packLanes(mix, out, count, gain, slope);
+    }
+
+    void sumGeneric(float *mix, const float *submix, const int64_t count) {
+        sumLanes(mix, submix, count);
+    }
+
+    float peakGeneric(const float *mix, const int64_t count) {
+        return peakLanes(mix, count);
+    }
+
+    int64_t packGeneric(const float *mix, int_osc_t *out, const int64_t count,
+                        const float gain, const float slope) {
+        return packLanes(mix, out, count, gain, slope);
+    }
+
+    // The mix stage's lanes, for the widest target the CPU supports.
+    struct Mixer {
+        SumLanes sum;
+        PeakLanes peak;
+        PackLanes pack;
+    };
+
+    Mixer mixer() {
+        const static string target = simdTarget();
+
+        if (target == "avx512")
+            return {sumAVX512, peakAVX512, packAVX512};
+
+        if (target == "avx2")
+            return {sumAVX2, peakAVX2, packAVX2};
+
+        return {sumGeneric, peakGeneric, packGeneric};
+    }
+}
+
+#endif
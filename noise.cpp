@@ -0,0 +1,89 @@
+#if !defined(NOISE)
+#define NOISE
+
+#include "waveform.cpp"
+#include <bit>
+#include <cstdint>
+#include <random>
+
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+
+namespace synth {
+    using namespace std;
+
+    // The only use of the kernel entropy source: a fresh seed per patch.
+    uint64_t entropySeed() {
+        uint64_t seed = 0;
+
+        if constexpr (__linux__) {
+            if (getrandom(&seed, sizeof(seed), 0) == sizeof(seed))
+                return seed;
+        }
+
+        return (uint64_t(random_device()()) << 32) ^ random_device()();
+    }
+
+    // SplitMix64 over a counter: the value at any index depends only on
+    // the seed and the index, so slices of a table can be filled
+    // independently and in any order, and every patch is reproducible.
+    constexpr uint64_t counterHash(const uint64_t seed, const uint64_t index) {
+        uint64_t value = seed + (index + 1UL) * 0x9e3779b97f4a7c15UL;
+
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9UL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebUL;
+
+        return value ^ (value >> 31);
+    }
+
+    // Uniform in [-1, 1).
+    constexpr double counterUniform(const uint64_t seed, const uint64_t index) {
+        return int64_t(counterHash(seed, index)) * 0x1p-63;
+    }
+
+    // White noise draws one value per sample. Pink and brown noise sum one
+    // row of values per octave, row k holding 2^k samples per value and
+    // interpolating linearly between them; equal row amplitudes give the
+    // 1/f spectrum of pink noise (Voss-McCartney), amplitudes rising by
+    // sqrt(2) per octave the 1/f^2 spectrum of brown noise. Rows slower
+    // than a sixteenth of the table would only add a drifting offset.
+    struct Noise {
+        enum Colour { White, Pink, Brown };
+
+        Colour colour;
+        uint64_t seed;
+
+        float128_t operator()(const int64_t time, const float128_t freq) const {
+            if (colour == White)
+                return counterUniform(seed, time);
+
+            const int64_t octaves =
+                max(int64_t(bit_width(uint64_t(freq2TPC(freq)))) - 4L, 1L);
+            const double growth = colour == Pink ? 1.0 : sqrt(2.0);
+            double amplitude = 1.0;
+            double power = 0.0;
+            double sum = 0.0;
+
+            for (int64_t octave = 0; octave < octaves; ++octave) {
+                const uint64_t row = counterHash(seed, octave);
+                const int64_t index = time >> octave;
+                const double frac =
+                    double(time & ((1L << octave) - 1L)) / (1L << octave);
+                const double from = counterUniform(row, index);
+                const double to = counterUniform(row, index + 1L);
+
+                sum += amplitude * (from + frac * (to - from));
+                power += amplitude * amplitude;
+                amplitude *= growth;
+            }
+
+            // Rows are uniform with variance 1/3, so the sum is close to
+            // normal with deviation sqrt(power / 3); scale it to a third
+            // and clip the rare outliers beyond three deviations.
+            return clamp(sum / sqrt(3.0 * power), -1.0, 1.0);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,240 @@
+#include "bank.cpp"
+#include "cache.cpp"
+#include "engine.cpp"
+#include "instrument.cpp"
+#include "partials.cpp"
+#include "score.cpp"
+#include "voicing.cpp"
+#include "wav.cpp"
+#include "wavetable.cpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace synth;
+
+// Renders a Standard MIDI File, or an event log recorded by the synth's
+// --record option, through the organ's tables and voice engine into a
+// WAV file, as fast as the CPU allows and one block at a time. Like the
+// benchmark it opens neither a window nor an audio device, but links
+// SFML's audio module for the sound streams the engine declares:
+//
+//     g++ -std=c++20 -O2 -pthread offline.cpp -o offline
+//         -lsfml-audio -lsfml-system
+//     offline [--waveform sine|0..11] [--approx 1] [--division 0.5]
+//             [--reverse] [--resampled] [--rate 48000] [--voices 16]
+//             [--block 256] [--envelope 0.005,0,1,0.03] [--tail 2]
+//             [--layer waveform]... [--cache dir]
+//             [--bank presets.bank [--preset 0]]
+//             [--headroom 0] [--ceiling 0|off]
+//             input.mid|input.log output.wav
+//
+// Each --layer adds a waveform, shaped like the first, that sounds every
+// note along with it. A preset from a bank the synth saved replaces the
+// waveform options and the envelope, and brings its tables along. The
+// mix is turned down by --headroom decibels and limited to --ceiling
+// decibels of full scale.
+
+bool parseEnvelope(const string &list, Envelope &envelope) {
+    float values[4];
+
+    if (sscanf(list.c_str(), "%f,%f,%f,%f", &values[0], &values[1],
+               &values[2], &values[3]) != 4)
+        return false;
+
+    envelope = {values[0], values[1], values[2], values[3]};
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    auto voicing = Voicing();
+    auto envelope = Envelope();
+    auto dynamics = Dynamics();
+    auto rate = defaultRate;
+    auto voices = 16L;
+    auto block = 256L;
+    auto tail = 2.0L;
+    auto cache = string();
+    auto presets = string();
+    auto preset = -1L;
+    auto paths = vector<string>();
+    auto layers = vector<int64_t>();
+
+    for (int64_t i = 1; i < argc; ++i) {
+        const auto option = string(argv[i]);
+        const bool valued = i + 1 < argc;
+
+        if (option == "--reverse")
+            voicing.reverse = true;
+        else if (option == "--resampled")
+            voicing.derivation = Derivation::Resampled;
+        else if (option.starts_with("--") and !valued) {
+            cerr << "Missing value for " << option << endl;
+            return 1;
+        } else if (option == "--waveform") {
+            voicing.select = parseWaveform(argv[++i]);
+
+            if (voicing.select < 0L) {
+                cerr << "Unknown waveform " << argv[i] << endl;
+                return 1;
+            }
+        } else if (option == "--layer") {
+            layers.push_back(parseWaveform(argv[++i]));
+
+            if (layers.back() < 0L) {
+                cerr << "Unknown waveform " << argv[i] << endl;
+                return 1;
+            }
+        } else if (option == "--approx")
+            voicing.approx = max(stoll(argv[++i]), 1LL);
+        else if (option == "--division")
+            voicing.division = stold(argv[++i]);
+        else if (option == "--rate")
+            rate = stold(argv[++i]);
+        else if (option == "--voices")
+            voices = max(stoll(argv[++i]), 1LL);
+        else if (option == "--block")
+            block = max(stoll(argv[++i]), 1LL);
+        else if (option == "--tail")
+            tail = max(stold(argv[++i]), 0.0L);
+        else if (option == "--cache")
+            cache = argv[++i];
+        else if (option == "--bank")
+            presets = argv[++i];
+        else if (option == "--preset")
+            preset = stoll(argv[++i]);
+        else if (option == "--headroom")
+            dynamics.headroom = stof(argv[++i]);
+        else if (option == "--ceiling") {
+            if (!parseCeiling(argv[++i], dynamics)) {
+                cerr << "Ceiling takes decibels or off" << endl;
+                return 1;
+            }
+        } else if (option == "--envelope") {
+            if (!parseEnvelope(argv[++i], envelope)) {
+                cerr << "Envelope takes attack,decay,sustain,release" << endl;
+                return 1;
+            }
+        } else if (option.starts_with("--")) {
+            cerr << "Unknown option " << option << endl;
+            return 1;
+        } else
+            paths.push_back(option);
+    }
+
+    if (paths.size() != 2) {
+        cerr << "Usage: offline [options] input.mid|input.log output.wav"
+             << endl;
+        return 1;
+    }
+
+    auto cues = vector<Cue>();
+    const auto &input = paths[0];
+    const bool midi = input.ends_with(".mid") or input.ends_with(".midi");
+
+    if (!(midi ? readMidiFile(input, cues) : readEventLog(input, cues))) {
+        cerr << "Cannot read " << input << endl;
+        return 1;
+    }
+
+    if (!cache.empty() and !tableCache.open(cache))
+        cerr << "Cannot open table cache " << cache << endl;
+
+    auto bank = PresetBank();
+
+    if (!presets.empty()) {
+        preset = max(preset, 0L);
+
+        if (!bank.open(presets) or preset >= bank.size()) {
+            cerr << "Cannot read preset " << preset << " from " << presets
+                 << endl;
+            return 1;
+        }
+
+        voicing = bank.at(preset).voicing;
+        envelope = bank.at(preset).envelope;
+        tableCache.attach(&bank);
+    }
+
+    const auto start = steady_clock::now();
+    const int64_t parts = layers.size() + 1L;
+    auto banks = vector<Mipmap>(parts, Organ::createBank(rate));
+    auto partials = Partials(banks[0]);
+    auto scratch = Scratch(banks[0], oversample);
+    auto engine = Engine(rate, voices, block, parts);
+    auto wav = WavWriter();
+    auto buffer = vector<int_osc_t>(block);
+
+    layers.insert(layers.begin(), voicing.select);
+
+    for (int64_t part = 0; part < parts; ++part) {
+        auto layer = voicing;
+
+        layer.select = layers[part];
+        buildMipmap(banks[part], patchOf(layer), &partials, &scratch);
+        engine.use(banks[part], part);
+    }
+
+    engine.shape(envelope);
+    engine.limit(dynamics);
+
+    if (!wav.open(paths[1], round(rate))) {
+        cerr << "Cannot write " << paths[1] << endl;
+        return 1;
+    }
+
+    const float128_t length = (cues.empty() ? 0.0L : cues.back().time) + tail;
+    const int64_t total = ceil(length * rate);
+    const int64_t delay = engine.getDelay();
+    size_t next = 0;
+
+    // The limiter holds the output back by delay samples; rendering that
+    // many more and dropping them from the front keeps notes on time.
+    for (int64_t position = 0; position < total + delay; position += block) {
+        const int64_t frames = min(block, total + delay - position);
+        const int64_t skip = clamp(delay - position, 0L, frames);
+        const float128_t end = (position + frames) / rate;
+
+        for (; next < cues.size() and cues[next].time < end; ++next) {
+            const auto &cue = cues[next];
+            const int64_t time = cue.time * 1e9L;
+
+            for (int64_t part = 0; part < parts; ++part)
+                if (cue.on)
+                    engine.noteOn(cue.note, Organ::getFrequency(cue.note),
+                                  cue.velocity / 127.0L, time, part);
+                else
+                    engine.noteOff(cue.note, time, part);
+        }
+
+        engine.render(buffer.data(), frames, position * 1e9L / rate);
+
+        if (!wav.write(buffer.data() + skip, frames - skip)) {
+            cerr << "Cannot write " << paths[1] << endl;
+            return 1;
+        }
+    }
+
+    if (!wav.close()) {
+        cerr << "Cannot write " << paths[1] << endl;
+        return 1;
+    }
+
+    const float128_t elapsed =
+        duration<float128_t>(steady_clock::now() - start).count();
+
+    if (const uint64_t dropped = telemetry.dropped.load(memory_order_relaxed))
+        cerr << "Dropped " << dropped << " note events on a full queue"
+             << endl;
+
+    cerr << "Rendered " << double(length) << " s in " << double(elapsed)
+         << " s, " << double(length / elapsed) << "x real time" << endl;
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#if !defined(PARTIALS)
+#define PARTIALS
+
+#include "spectrum.cpp"
+#include "waveform.cpp"
+#include "wavetable.cpp"
+#include <algorithm>
+#include <complex>
+#include <span>
+#include <vector>
+
+namespace synth {
+    using namespace std;
+
+    // A mipmap's levels kept as unrounded sums of their harmonics, each
+    // tapered by its level's sigma factor as in bandlimit. The Fourier
+    // waveforms' spectra at neighbouring approx share their harmonics up
+    // to a common factor and an offset, so a retune to such a spectrum
+    // rescales the sums and adds or removes only the harmonics that
+    // differ. Any other spectrum is resynthesized whole, and so is every
+    // refresh-th retune, before rounding drift could reach a sample.
+    class Partials {
+    public:
+        Partials(const Mipmap &mipmap)
+            : _sums(mipmap.levels.size()), _limits(mipmap.levels.size()),
+              _cycle(mipmap.levels[0].size()),
+              _twiddle(mipmap.levels[0].size() / 2L) {
+            for (size_t k = 0; k < _sums.size(); ++k) {
+                _sums[k].resize(mipmap.levels[k].size());
+                _limits[k] = mipmap.harmonics(k);
+            }
+
+            _top = _limits[0] + 1L;
+            _spectrum.sine.reserve(_top);
+            _spectrum.cosine.reserve(_top);
+        }
+
+        // Fills mipmap, which must have the geometry the partials were
+        // made for, with spectrum.
+        void retune(const Spectrum &spectrum, Mipmap &mipmap) {
+            if (!_update(spectrum))
+                _resynthesize(spectrum);
+
+            _keep(spectrum);
+
+            const double offset = real(spectrum.at(0));
+
+            for (size_t k = 0; k < _sums.size(); ++k)
+                for (size_t time = 0; time < _sums[k].size(); ++time)
+                    mipmap.levels[k][time] = clamp(
+                        round(maxAmp * (offset + _sums[k][time])), -maxAmp,
+                        maxAmp);
+        }
+
+        constexpr static int64_t refresh = 256L;
+        constexpr static int64_t reach = 64L;
+
+    private:
+        // Retunes from the current spectrum if the harmonics both share
+        // are one real multiple of the other and at most reach differ.
+        bool _update(const Spectrum &spectrum) {
+            const int64_t before = _spectrum.harmonics();
+            const int64_t after = min(spectrum.harmonics(), _top);
+            const int64_t shared = min(before, after);
+
+            if (_updates >= refresh or before == 0L or
+                max(before, after) - shared > reach)
+                return false;
+
+            int64_t largest = 0L;
+
+            for (int64_t i = 1L; i < shared; ++i)
+                if (abs(_spectrum.at(i)) > abs(_spectrum.at(largest)))
+                    largest = i;
+
+            const float128_t magnitude = abs(_spectrum.at(largest));
+            const float128_t ratio =
+                largest ? real(spectrum.at(largest) / _spectrum.at(largest))
+                        : 1.0L;
+
+            for (int64_t i = 1L; i < shared; ++i)
+                if (abs(spectrum.at(i) - ratio * _spectrum.at(i)) >
+                    1e-12L * magnitude)
+                    return false;
+
+            for (size_t k = 0; k < _sums.size(); ++k) {
+                for (auto &sum : _sums[k])
+                    sum *= ratio;
+
+                for (int64_t i = shared; i < before; ++i)
+                    _add(k, i, -ratio * _spectrum.at(i));
+
+                for (int64_t i = shared; i < after; ++i)
+                    _add(k, i, spectrum.at(i));
+            }
+
+            ++_updates;
+
+            return true;
+        }
+
+        // Keeps the harmonics a level can hold, which is all a retune looks
+        // at, in the room reserved for them.
+        void _keep(const Spectrum &spectrum) {
+            auto keep = [this](vector<float128_t> &to,
+                               const vector<float128_t> &from) {
+                to.assign(from.begin(),
+                          from.begin() + min<int64_t>(from.size(), _top));
+            };
+
+            keep(_spectrum.sine, spectrum.sine);
+            keep(_spectrum.cosine, spectrum.cosine);
+        }
+
+        // Adds harmonic i with the given amplitude to level k by rotating
+        // one phasor along the level.
+        void _add(const size_t k, const int64_t i, const complex_t amplitude) {
+            auto &sums = _sums[k];
+
+            if (i < 1L or i > _limits[k] or amplitude == 0.0L)
+                return;
+
+            const double x = M_PI * i / (_limits[k] + 1L);
+            const auto value = complex<double>(amplitude) * (sin(x) / x);
+            const auto step = polar(1.0, 2.0 * M_PI * i / sums.size());
+            auto phasor = complex<double>(1.0, 0.0);
+
+            for (auto &sum : sums) {
+                sum += real(value * phasor);
+                phasor *= step;
+            }
+        }
+
+        void _resynthesize(const Spectrum &spectrum) {
+            for (size_t k = 0; k < _sums.size(); ++k) {
+                const int64_t length = _sums[k].size();
+                const int64_t top = min(spectrum.harmonics() - 1L, _limits[k]);
+                const auto cycle = span(_cycle).first(length);
+
+                fill(cycle.begin(), cycle.end(), complex_t());
+
+                for (int64_t i = 1L; i <= top; ++i) {
+                    const float128_t x = pi * i / (_limits[k] + 1L);
+
+                    cycle[i] = 0.5L * length * (sin(x) / x) * spectrum.at(i);
+                    cycle[length - i] = conj(cycle[i]);
+                }
+
+                fft(cycle, _twiddle, true);
+
+                for (int64_t time = 0; time < length; ++time)
+                    _sums[k][time] = real(cycle[time]);
+            }
+
+            _updates = 0L;
+        }
+
+        vector<vector<double>> _sums;
+
+        vector<int64_t> _limits;
+
+        vector<complex_t> _cycle;
+
+        vector<complex_t> _twiddle;
+
+        Spectrum _spectrum;
+
+        int64_t _top = 0L;
+
+        int64_t _updates = 0L;
+    };
+}
+
+#endif
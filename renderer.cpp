@@ -0,0 +1,86 @@
+#if !defined(RENDERER)
+#define RENDERER
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Workers that run table builds off the UI thread.
+class Renderer {
+public:
+    Renderer(int64_t workers = thread::hardware_concurrency()) {
+        for (int64_t i = 0; i < max(workers, 1L); ++i)
+            _workers.emplace_back([this]() { _work(); });
+    }
+
+    ~Renderer() {
+        {
+            auto lock = unique_lock(_mutex);
+            _done = true;
+        }
+
+        _wake.notify_all();
+
+        for (auto &worker : _workers)
+            worker.join();
+    }
+
+    Renderer(const Renderer &) = delete;
+    Renderer &operator=(const Renderer &) = delete;
+
+    // Runs a whole task on the pool.
+    future<void> run(function<void()> task) {
+        auto job = make_shared<packaged_task<void()>>(move(task));
+        auto ready = job->get_future();
+
+        {
+            auto lock = unique_lock(_mutex);
+            _queue.push_back([job]() { (*job)(); });
+        }
+
+        _wake.notify_one();
+
+        return ready;
+    }
+
+private:
+    void _work() {
+        while (true) {
+            auto task = function<void()>();
+
+            {
+                auto lock = unique_lock(_mutex);
+                _wake.wait(lock, [this]() { return _done or !_queue.empty(); });
+
+                if (_queue.empty())
+                    return;
+
+                task = move(_queue.front());
+                _queue.pop_front();
+            }
+
+            task();
+        }
+    }
+
+    vector<thread> _workers;
+
+    deque<function<void()>> _queue;
+
+    mutex _mutex;
+
+    condition_variable _wake;
+
+    bool _done = false;
+};
+
+#endif
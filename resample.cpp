@@ -0,0 +1,198 @@
+#if !defined(RESAMPLE)
+#define RESAMPLE
+
+#include "kernel.cpp"
+#include "waveform.cpp"
+#include "wavetable.cpp"
+#include <cstring>
+#include <vector>
+
+namespace synth {
+    using namespace std;
+
+    // How a mipmap's levels are derived from its one evaluated cycle:
+    // Spectral renders cycleLength samples and cuts their spectrum per
+    // level; Resampled renders oversample times as many and low-pass
+    // filters them down to each level in the time domain.
+    enum class Derivation { Spectral, Resampled };
+
+    constexpr int64_t oversample = 8L;
+
+    // Fills taps with a Blackman-windowed sinc that keeps the harmonics of
+    // a cycle of length samples up to three quarters of harmonics
+    // untouched and stops them from harmonics + 1 on, with unit gain at
+    // DC. There is a whole number of lanes of taps: an odd count centred on
+    // (size - 1) / 2, and a zero. The window's cosines and the sinc's sine
+    // come from rotating phasors, as in synthesizeSpectrum.
+    void lowpassTaps(vector<float> &taps, const int64_t length,
+                     const int64_t harmonics, const int64_t lanes) {
+        const double pass = 0.75 * harmonics;
+        const double stop = harmonics + 1.0;
+        const double cutoff = (pass + stop) / (2.0 * length);
+        const int64_t needed =
+            min<int64_t>(ceil(5.5 * length / (stop - pass)), 8L * length);
+        taps.assign((needed / lanes + 1L) * lanes, 0.0f);
+
+        const int64_t count = taps.size() - 1L;
+        const int64_t half = count / 2L;
+        const auto step = polar(1.0, 2.0 * M_PI / (count - 1L));
+        const auto turn = polar(1.0, 2.0 * M_PI * cutoff);
+        auto window = complex<double>(1.0, 0.0);
+        auto sine = polar(1.0, -2.0 * M_PI * cutoff * half);
+        double sum = 0.0;
+
+        for (int64_t i = 0; i < count; ++i) {
+            const double x = i - half;
+            const double blackman =
+                0.42 - 0.5 * real(window) + 0.08 * real(window * window);
+            const double sinc = x == 0.0 ? 2.0 * cutoff : imag(sine) / (M_PI * x);
+
+            taps[i] = blackman * sinc;
+            sum += taps[i];
+            window *= step;
+            sine *= turn;
+        }
+
+        for (auto &tap : taps)
+            tap /= sum;
+    }
+
+    // table[n] = sum over j of taps[j] * padded[n * factor + j], where
+    // padded is the master cycle wrapped around by half the taps on each
+    // side, so that every dot product runs over contiguous lanes.
+    template <class Real>
+    [[gnu::always_inline]] inline void
+    decimateLanes(const Real *padded, const Real *taps, const int64_t count,
+                  Real *table, const int64_t length, const int64_t factor) {
+        using lanes = lanes_t<Real>;
+        constexpr int64_t width = sizeof(lanes) / sizeof(Real);
+
+        for (int64_t n = 0; n < length; ++n) {
+            const Real *window = padded + n * factor;
+            lanes sum = {};
+
+            for (int64_t j = 0; j < count; j += width) {
+                lanes x, y;
+
+                memcpy(&x, window + j, sizeof(lanes));
+                memcpy(&y, taps + j, sizeof(lanes));
+                sum += x * y;
+            }
+
+            Real total = 0;
+
+            for (int64_t i = 0; i < width; ++i)
+                total += sum[i];
+
+            table[n] = total;
+        }
+    }
+
+    using DecimateLanes = void (*)(const float *, const float *, const int64_t,
+                                   float *, const int64_t, const int64_t);
+
+    [[gnu::target("avx512f,avx512bw,avx512dq")]] void
+    decimateAVX512(const float *padded, const float *taps, const int64_t count,
+                   float *table, const int64_t length, const int64_t factor) {
+        decimateLanes<float>(padded, taps, count, table, length, factor);
+    }
+
+    [[gnu::target("avx2,fma")]] void
+    decimateAVX2(const float *padded, const float *taps, const int64_t count,
+                 float *table, const int64_t length, const int64_t factor) {
+        decimateLanes<float>(padded, taps, count, table, length, factor);
+    }
+
+    void decimateGeneric(const float *padded, const float *taps,
+                         const int64_t count, float *table,
+                         const int64_t length, const int64_t factor) {
+        decimateLanes<float>(padded, taps, count, table, length, factor);
+    }
+
+    DecimateLanes dispatchDecimate() {
+        const static string target = simdTarget();
+
+        if (target == "avx512")
+            return decimateAVX512;
+
+        if (target == "avx2")
+            return decimateAVX2;
+
+        return decimateGeneric;
+    }
+
+    // Filters the oversampled master cycle in scratch down to every level
+    // of mipmap: the levels divide the master evenly, so each one needs a
+    // single phase of its filter rather than a polyphase bank. A sharp cut
+    // rings by up to a sixth of a jump in the waveform, so rather than
+    // clip the ringing, all levels share the gain that fits the loudest
+    // one.
+    void decimateCycle(Mipmap &mipmap, Scratch &scratch) {
+        constexpr int64_t width = sizeof(lanes_t<float>) / sizeof(float);
+        const int64_t length = cycleLength * oversample;
+        const DecimateLanes decimate = dispatchDecimate();
+        const auto &master = scratch.cycle;
+        auto &taps = scratch.taps;
+        auto &padded = scratch.padded;
+        auto &filtered = scratch.filtered;
+        float peak = maxAmp;
+
+        filtered.resize(mipmap.samples().size());
+
+        for (size_t k = 0, offset = 0; k < mipmap.levels.size(); ++k) {
+            float *level = filtered.data() + offset;
+            const int64_t size = mipmap.levels[k].size();
+            const int64_t factor = length / size;
+
+            lowpassTaps(taps, length, mipmap.harmonics(k), width);
+            padded.resize(length + taps.size());
+
+            const int64_t half = (taps.size() - 1L) / 2L;
+
+            for (int64_t i = 0; i < int64_t(padded.size()); ++i)
+                padded[i] = master[((i - half) % length + length) % length];
+
+            decimate(padded.data(), taps.data(), taps.size(), level, size,
+                     factor);
+
+            for (int64_t time = 0; time < size; ++time)
+                peak = max(peak, abs(level[time]));
+
+            offset += size;
+        }
+
+        const float gain = maxAmp / peak;
+        auto samples = mipmap.samples();
+
+        for (size_t i = 0; i < samples.size(); ++i)
+            samples[i] = round(gain * filtered[i]);
+    }
+
+    void resampleMipmap(Mipmap &mipmap, const BuildWavetable &build,
+                        Scratch &scratch) {
+        const int64_t length = cycleLength * oversample;
+
+        scratch.cycle.resize(length);
+        build(scratch.cycle, tpc2Freq(length), maxAmp);
+        decimateCycle(mipmap, scratch);
+    }
+
+    // As additive(spectrum) would render it, in the scratch's buffers.
+    void resampleMipmap(Mipmap &mipmap, const Spectrum &spectrum,
+                        Scratch &scratch) {
+        const int64_t length = cycleLength * oversample;
+
+        scratch.cycle.resize(length);
+        additiveFill(spectrum, scratch.cycle, tpc2Freq(length), maxAmp, 0L,
+                     length, scratch.synthesis);
+        decimateCycle(mipmap, scratch);
+    }
+
+    void resampleMipmap(Mipmap &mipmap, const BuildWavetable &build) {
+        auto scratch = Scratch(mipmap, oversample);
+
+        resampleMipmap(mipmap, build, scratch);
+    }
+}
+
+#endif
@@ -0,0 +1,54 @@
+#if !defined(RING)
+#define RING
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+using namespace std;
+
+// A bounded single-producer, single-consumer queue: push only ever runs on
+// one thread and pop on one other, so neither takes a lock or allocates.
+template <class Item, int64_t capacity> class Ring {
+    static_assert(has_single_bit(uint64_t(capacity)));
+
+public:
+    bool push(const Item &item) {
+        const uint64_t tail = _tail.load(memory_order_relaxed);
+
+        if (tail - _head.load(memory_order_acquire) == capacity)
+            return false;
+
+        _items[tail & (capacity - 1L)] = item;
+        _tail.store(tail + 1UL, memory_order_release);
+
+        return true;
+    }
+
+    bool pop(Item &item) {
+        const uint64_t head = _head.load(memory_order_relaxed);
+
+        if (head == _tail.load(memory_order_acquire))
+            return false;
+
+        item = _items[head & (capacity - 1L)];
+        _head.store(head + 1UL, memory_order_release);
+
+        return true;
+    }
+
+    int64_t size() const {
+        return _tail.load(memory_order_acquire) -
+               _head.load(memory_order_acquire);
+    }
+
+private:
+    alignas(64) atomic<uint64_t> _head = 0UL;
+
+    alignas(64) atomic<uint64_t> _tail = 0UL;
+
+    array<Item, capacity> _items;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#if !defined(SCORE)
+#define SCORE
+
+#include "waveform.cpp"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace synth;
+
+// A note switched on or off at a time in seconds from the start of a
+// performance, with a MIDI velocity.
+struct Cue {
+    float128_t time;
+    bool on;
+    int64_t note;
+    int64_t velocity;
+};
+
+// One cue per line, as "<seconds> on <note> <velocity>" or
+// "<seconds> off <note>": what the live synth records and the offline
+// renderer plays back.
+void writeCue(ostream &out, const Cue &cue) {
+    out << double(cue.time) << (cue.on ? " on " : " off ") << cue.note;
+
+    if (cue.on)
+        out << " " << cue.velocity;
+
+    out << "\n";
+}
+
+bool readEventLog(const string &path, vector<Cue> &cues) {
+    auto file = ifstream(path);
+    auto line = string();
+
+    if (!file)
+        return false;
+
+    while (getline(file, line)) {
+        auto fields = istringstream(line);
+        auto type = string();
+        auto cue = Cue{0.0L, false, 0L, 0L};
+        double time = 0.0;
+
+        if (line.empty() or line[0] == '#')
+            continue;
+
+        if (!(fields >> time >> type >> cue.note) or
+            (type != "on" and type != "off"))
+            return false;
+
+        cue.time = time;
+        cue.on = type == "on";
+
+        if (cue.on and !(fields >> cue.velocity))
+            return false;
+
+        cues.push_back(cue);
+    }
+
+    stable_sort(cues.begin(), cues.end(), [](const Cue &a, const Cue &b) {
+        return a.time < b.time;
+    });
+
+    return true;
+}
+
+// Reads the notes of every track of a Standard MIDI File, of format 0 or
+// 1, into cues in time order; channels are merged. Times follow the
+// file's tempo map, or its SMPTE frame rate. Fails on anything truncated
+// or malformed rather than guessing.
+bool readMidiFile(const string &path, vector<Cue> &cues) {
+    auto file = ifstream(path, ios::binary);
+    const auto data =
+        vector<uint8_t>(istreambuf_iterator<char>(file), {});
+    size_t at = 0;
+
+    auto take = [&](const size_t count, uint64_t &value) {
+        if (at + count > data.size())
+            return false;
+
+        value = 0UL;
+
+        for (size_t i = 0; i < count; ++i)
+            value = value << 8 | data[at++];
+
+        return true;
+    };
+
+    auto quantity = [&](uint64_t &value) {
+        value = 0UL;
+
+        for (int64_t i = 0; i < 4L; ++i) {
+            if (at >= data.size())
+                return false;
+
+            value = value << 7 | (data[at] & 0x7fU);
+
+            if (!(data[at++] & 0x80U))
+                return true;
+        }
+
+        return false;
+    };
+
+    struct Tick {
+        uint64_t tick;
+        Cue cue;
+    };
+
+    auto notes = vector<Tick>();
+    auto tempos = vector<pair<uint64_t, uint64_t>>();
+    uint64_t tag, length, format, tracks, division;
+
+    if (!file or !take(4, tag) or tag != 0x4d546864UL or
+        !take(4, length) or length < 6UL or !take(2, format) or
+        !take(2, tracks) or !take(2, division) or format > 1UL or
+        division == 0UL)
+        return false;
+
+    at += length - 6UL;
+
+    for (uint64_t track = 0; track < tracks; ++track) {
+        if (!take(4, tag) or !take(4, length) or
+            at + length > data.size())
+            return false;
+
+        const size_t end = at + length;
+        uint64_t tick = 0UL;
+        uint8_t status = 0U;
+
+        if (tag != 0x4d54726bUL) {
+            at = end;
+            continue;
+        }
+
+        while (at < end) {
+            uint64_t delta, first, second, size;
+
+            if (!quantity(delta) or at >= end)
+                return false;
+
+            tick += delta;
+
+            if (data[at] & 0x80U)
+                status = data[at++];
+
+            if (status == 0xffU) {
+                uint64_t type;
+
+                if (!take(1, type) or !quantity(size) or at + size > end)
+                    return false;
+
+                if (type == 0x51UL and size == 3UL) {
+                    uint64_t tempo = 0UL;
+
+                    take(3, tempo);
+                    tempos.push_back({tick, tempo});
+                } else
+                    at += size;
+
+                status = 0U;
+                continue;
+            }
+
+            if (status == 0xf0U or status == 0xf7U) {
+                if (!quantity(size) or at + size > end)
+                    return false;
+
+                at += size;
+                status = 0U;
+                continue;
+            }
+
+            const uint8_t kind = status & 0xf0U;
+
+            if (kind < 0x80U or !take(1, first))
+                return false;
+
+            if (kind == 0xc0U or kind == 0xd0U)
+                continue;
+
+            if (!take(1, second))
+                return false;
+
+            if (kind == 0x90U and second > 0UL)
+                notes.push_back({tick, {0.0L, true, int64_t(first),
+                                        int64_t(second)}});
+            else if (kind == 0x80U or kind == 0x90U)
+                notes.push_back({tick, {0.0L, false, int64_t(first), 0L}});
+        }
+
+        at = end;
+    }
+
+    auto byTick = [](const auto &a, const auto &b) {
+        return a.tick < b.tick;
+    };
+
+    stable_sort(notes.begin(), notes.end(), byTick);
+    stable_sort(tempos.begin(), tempos.end());
+
+    // Ticks become seconds piecewise between tempo changes, at 120 bpm
+    // before the first one.
+    const bool smpte = division & 0x8000UL;
+    const float128_t frames = -int8_t(division >> 8);
+    const float128_t perTick =
+        smpte ? 1.0L / (frames * (division & 0xffUL)) : 0.0L;
+    float128_t seconds = 0.0L;
+    uint64_t last = 0UL;
+    uint64_t tempo = 500000UL;
+    size_t change = 0;
+
+    for (auto &[tick, cue] : notes) {
+        if (!smpte)
+            for (; change < tempos.size() and tempos[change].first <= tick;
+                 ++change) {
+                seconds += (tempos[change].first - last) * 1e-6L * tempo /
+                           division;
+                last = tempos[change].first;
+                tempo = tempos[change].second;
+            }
+
+        cue.time = smpte ? tick * perTick
+                         : seconds + (tick - last) * 1e-6L * tempo / division;
+        cues.push_back(cue);
+    }
+
+    return true;
+}
+
+#endif
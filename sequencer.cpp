@@ -3,83 +3,336 @@
 
 #if defined(__linux__)
 #include <alsa/asoundlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #endif
 
 #include "instrument.cpp"
+#include "score.cpp"
 #include "waveform.cpp"
+#include <array>
+#include <cerrno>
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <string>
 #include <thread>
+#include <vector>
 
 using namespace std::chrono;
 
+// Listens on an ALSA sequencer port and plays what arrives on the organ.
+// The port is connected from the given sources, as "client:port" or a
+// client name, or else from every MIDI port found when it opens. The
+// listening thread sleeps in poll() on the sequencer and on a wake pipe,
+// drains every pending event into a batch per wakeup and hands the batch
+// to the organ in order; stop() wakes it through the pipe and joins it.
+//
+// Note-offs, controllers and pitch bend are understood as well as
+// note-ons: the sustain pedal holds released notes until it lifts, all
+// notes off and all sound off release everything, and volume and pitch
+// bend reach the engine. With record open, the notes as the organ plays
+// them, sustain included, are logged as cues for offline rendering.
 class Sequencer {
 public:
-    Sequencer() { init(); }
+    Sequencer(const vector<string> &sources = {},
+              const string &record = string()) {
+        if (!record.empty()) {
+            _record.open(record);
+
+            if (!_record)
+                cerr << "Cannot write " << record << endl;
+        }
+
+        _open(sources);
+    }
+
+    ~Sequencer() {
+        stop();
+
+        if (_wake[0] >= 0) {
+            close(_wake[0]);
+            close(_wake[1]);
+        }
+
+        if (_handle)
+            snd_seq_close(_handle);
+    }
+
+    Sequencer(const Sequencer &) = delete;
+    Sequencer &operator=(const Sequencer &) = delete;
+
+    bool isOpen() const { return _handle and _wake[0] >= 0; }
 
     void loop(Organ &organ) {
-        _taskMIDI =
-            thread([this](Organ &organ) { loopMIDI(organ); }, ref(organ));
-        _taskMIDI.detach();
+        if (isOpen() and !_listener.joinable())
+            _listener = thread([this, &organ]() { _listen(organ); });
+    }
+
+    void stop() {
+        if (!_listener.joinable())
+            return;
+
+        const char byte = 0;
 
-        /*_taskADSR =
-            thread([this](Organ &organ) { loopADSR(organ); }, ref(organ));
-        _taskADSR.detach();*/
+        while (write(_wake[1], &byte, 1) < 0 and errno == EINTR)
+            ;
+
+        _listener.join();
     }
 
+    constexpr static int64_t batch = 64L;
+
+    constexpr static int64_t sustain = 64L;
+
+    constexpr static int64_t volume = 7L;
+
+    constexpr static int64_t allSoundOff = 120L;
+
+    constexpr static int64_t allNotesOff = 123L;
+
+    // Semitones either way at full pitch bend.
+    constexpr static float128_t bendRange = 2.0L;
+
 private:
-    void loopADSR(Organ &organ) {
-        while (true) {
-            for (int64_t i = 0; i < 49; ++i) {
+    void _open(const vector<string> &sources) {
+        int result = snd_seq_open(&_handle, "default", SND_SEQ_OPEN_INPUT,
+                                  SND_SEQ_NONBLOCK);
+
+        if (result < 0) {
+            cerr << "Cannot open the ALSA sequencer: " << snd_strerror(result)
+                 << endl;
+            _handle = nullptr;
+            return;
+        }
+
+        if ((result = snd_seq_set_client_name(_handle, "Synth")) < 0)
+            cerr << "Cannot name the sequencer client: "
+                 << snd_strerror(result) << endl;
+
+        _port = snd_seq_create_simple_port(
+            _handle, "in", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+            SND_SEQ_PORT_TYPE_APPLICATION);
+
+        if (_port < 0) {
+            cerr << "Cannot create a sequencer port: " << snd_strerror(_port)
+                 << endl;
+            snd_seq_close(_handle);
+            _handle = nullptr;
+            return;
+        }
+
+        if (pipe2(_wake, O_CLOEXEC) != 0) {
+            cerr << "Cannot create the sequencer's wake pipe" << endl;
+            _wake[0] = _wake[1] = -1;
+            return;
+        }
+
+        for (const auto &source : sources) {
+            auto address = snd_seq_addr_t();
+
+            if ((result = snd_seq_parse_address(_handle, &address,
+                                                source.c_str())) < 0 or
+                (result = snd_seq_connect_from(_handle, _port, address.client,
+                                               address.port)) < 0)
+                cerr << "Cannot connect from " << source << ": "
+                     << snd_strerror(result) << endl;
+        }
+
+        if (sources.empty())
+            _discover();
+    }
+
+    // Connects from every readable MIDI port of every other client,
+    // leaving out the system client's timer and announcements.
+    void _discover() {
+        const int self = snd_seq_client_id(_handle);
+        snd_seq_client_info_t *client;
+        snd_seq_port_info_t *port;
+        int64_t connected = 0;
+
+        snd_seq_client_info_alloca(&client);
+        snd_seq_port_info_alloca(&port);
+        snd_seq_client_info_set_client(client, -1);
+
+        while (snd_seq_query_next_client(_handle, client) >= 0) {
+            const int id = snd_seq_client_info_get_client(client);
+            constexpr unsigned int readable =
+                SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+
+            if (id == self or id == SND_SEQ_CLIENT_SYSTEM)
+                continue;
+
+            snd_seq_port_info_set_client(port, id);
+            snd_seq_port_info_set_port(port, -1);
+
+            while (snd_seq_query_next_port(_handle, port) >= 0) {
+                const int number = snd_seq_port_info_get_port(port);
+
+                if ((snd_seq_port_info_get_capability(port) & readable) !=
+                        readable or
+                    !(snd_seq_port_info_get_type(port) &
+                      SND_SEQ_PORT_TYPE_MIDI_GENERIC))
+                    continue;
+
+                const int result =
+                    snd_seq_connect_from(_handle, _port, id, number);
+
+                if (result < 0)
+                    cerr << "Cannot connect from " << id << ":" << number
+                         << ": " << snd_strerror(result) << endl;
+                else
+                    ++connected;
             }
         }
+
+        if (connected == 0L)
+            cerr << "No MIDI ports found; connect one to the synth's port"
+                 << endl;
     }
 
-    void loopMIDI(Organ &organ) {
+    void _listen(Organ &organ) {
+        const int count = snd_seq_poll_descriptors_count(_handle, POLLIN);
+        auto fds = vector<pollfd>(max(count, 0) + 1);
+        auto events = array<snd_seq_event_t, batch>();
+
+        fds[0] = {_wake[0], POLLIN, 0};
+        snd_seq_poll_descriptors(_handle, fds.data() + 1, fds.size() - 1,
+                                 POLLIN);
+
         while (true) {
-            snd_seq_event_input(_handle, &_event);
-            int64_t note = _event->data.note.note;
-            int64_t velocity = _event->data.note.velocity;
-
-            if (_event->type == SND_SEQ_EVENT_NOTEON) {
-                if (velocity == 0) {
-                    organ.setVolume(note, 0);
-                    // organ.stop(note);
-                } else {
-                    // organ.play(note);
-                    organ.setVolume(note, 100.0L * (velocity / 127.0L));
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                cerr << "Cannot poll the sequencer" << endl;
+                return;
+            }
+
+            if (fds[0].revents)
+                return;
+
+            int64_t size = 0;
+
+            while (true) {
+                snd_seq_event_t *event = nullptr;
+                const int result = snd_seq_event_input(_handle, &event);
+
+                if (result == -EAGAIN)
+                    break;
+
+                if (result == -ENOSPC) {
+                    cerr << "Sequencer input overran; events were lost"
+                         << endl;
+                    continue;
+                }
+
+                if (result < 0 or !event)
+                    break;
+
+                events[size++] = *event;
+
+                if (size == batch) {
+                    _dispatch(organ, events.data(), size);
+                    size = 0;
                 }
             }
+
+            _dispatch(organ, events.data(), size);
         }
     }
 
-    snd_seq_t *_handle;
-    int64_t _port;
-    snd_seq_event_t *_event;
-    thread _taskMIDI;
-    thread _taskADSR;
+    void _dispatch(Organ &organ, const snd_seq_event_t *events,
+                   const int64_t count) {
+        for (int64_t i = 0; i < count; ++i) {
+            const auto &event = events[i];
+            const int64_t note = event.data.note.note & 0x7f;
+            const int64_t velocity = event.data.note.velocity;
 
-    void init() {
-        snd_seq_open(&_handle, "default", SND_SEQ_OPEN_INPUT, 0);
-        snd_seq_set_client_name(_handle, "Keyboard Listener");
-        _port = snd_seq_create_simple_port(
-            _handle, "in", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-            SND_SEQ_PORT_TYPE_APPLICATION);
+            switch (event.type) {
+                case SND_SEQ_EVENT_NOTEON:
+                    if (velocity > 0L) {
+                        _press(organ, note, velocity);
+                        break;
+                    }
+
+                    [[fallthrough]];
+                case SND_SEQ_EVENT_NOTEOFF:
+                    if (_pedal)
+                        _held[note] = true;
+                    else
+                        _release(organ, note);
+                    break;
+                case SND_SEQ_EVENT_CONTROLLER:
+                    _control(organ, event.data.control.param,
+                             event.data.control.value);
+                    break;
+                case SND_SEQ_EVENT_PITCHBEND:
+                    organ.bend(exp2(event.data.control.value / 8192.0L *
+                                    bendRange / 12.0L));
+                    break;
+            }
+        }
+    }
+
+    void _control(Organ &organ, const int64_t param, const int64_t value) {
+        if (param == sustain) {
+            _pedal = value >= 64L;
+
+            if (_pedal)
+                return;
+
+            for (int64_t note = 0; note < int64_t(_held.size()); ++note)
+                if (_held[note])
+                    _release(organ, note);
+        } else if (param == allNotesOff or param == allSoundOff) {
+            _pedal = false;
+
+            for (int64_t note = 0; note < int64_t(_held.size()); ++note)
+                if (_held[note] or organ.isActive(note))
+                    _release(organ, note);
+        } else if (param == volume)
+            organ.setVolume(value / 127.0L);
+    }
+
+    void _press(Organ &organ, const int64_t note, const int64_t velocity) {
+        _held[note] = false;
+        organ.noteOn(note, velocity / 127.0L);
+        _log(note, velocity);
+    }
+
+    void _release(Organ &organ, const int64_t note) {
+        _held[note] = false;
+        organ.noteOff(note);
+        _log(note, 0L);
+    }
+
+    void _log(const int64_t note, const int64_t velocity) {
+        if (!_record)
+            return;
+
+        const float128_t time =
+            duration<float128_t>(steady_clock::now() - _start).count();
 
-        snd_seq_addr_t sender, dest;
-        snd_seq_port_subscribe_t *subs;
-        sender.client = 24;
-        sender.port = 1;
-        dest.client = 130;
-        dest.port = 0;
-        snd_seq_port_subscribe_alloca(&subs);
-        snd_seq_port_subscribe_set_sender(subs, &sender);
-        snd_seq_port_subscribe_set_dest(subs, &dest);
-        snd_seq_port_subscribe_set_queue(subs, 1);
-        snd_seq_port_subscribe_set_time_update(subs, 1);
-        snd_seq_port_subscribe_set_time_real(subs, 1);
-        snd_seq_subscribe_port(_handle, subs);
+        writeCue(_record, {time, velocity > 0L, note, velocity});
     }
+
+    snd_seq_t *_handle = nullptr;
+
+    int _port = -1;
+
+    int _wake[2] = {-1, -1};
+
+    thread _listener;
+
+    bool _pedal = false;
+
+    array<bool, 128> _held = {};
+
+    ofstream _record;
+
+    steady_clock::time_point _start = steady_clock::now();
 };
 
 #endif
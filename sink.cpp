@@ -0,0 +1,343 @@
+#if !defined(SINK)
+#define SINK
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "ring.cpp"
+#include "telemetry.cpp"
+#include "wav.cpp"
+#include "waveform.cpp"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace synth;
+
+// Somewhere the mix goes as it is played. Every call comes from the
+// recorder's writer thread, open() included, so that a FIFO waiting for
+// its reader or a slow disk holds up nothing but the writer.
+class Sink {
+public:
+    virtual ~Sink() = default;
+
+    virtual bool open() = 0;
+
+    virtual bool write(const int_osc_t *samples, int64_t count) = 0;
+
+    virtual bool close() = 0;
+
+    virtual string describe() const = 0;
+};
+
+class WavSink : public Sink {
+public:
+    WavSink(const string &path, const float128_t rate)
+        : _path(path), _rate(round(rate)) {}
+
+    bool open() override { return _wav.open(_path, _rate); }
+
+    bool write(const int_osc_t *samples, const int64_t count) override {
+        return _wav.write(samples, count);
+    }
+
+    bool close() override { return _wav.close(); }
+
+    string describe() const override { return _path; }
+
+private:
+    string _path;
+
+    int64_t _rate;
+
+    WavWriter _wav;
+};
+
+// Headerless 16-bit mono PCM to standard output, "-", or to a file or
+// FIFO. A reader that goes away fails the write rather than raising
+// SIGPIPE.
+class RawSink : public Sink {
+public:
+    RawSink(const string &path) : _path(path) {}
+
+    bool open() override {
+#if defined(__linux__)
+        signal(SIGPIPE, SIG_IGN);
+
+        constexpr int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+        _file = _path == "-" ? STDOUT_FILENO
+                             : ::open(_path.c_str(), flags, 0644);
+
+        return _file >= 0;
+#else
+        return false;
+#endif
+    }
+
+    bool write(const int_osc_t *samples, const int64_t count) override {
+#if defined(__linux__)
+        const auto *data = reinterpret_cast<const char *>(samples);
+        size_t left = count * sizeof(int_osc_t);
+
+        while (left > 0UL) {
+            const ssize_t written = ::write(_file, data, left);
+
+            if (written < 0 and errno == EINTR)
+                continue;
+
+            if (written <= 0)
+                return false;
+
+            data += written;
+            left -= written;
+        }
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool close() override {
+#if defined(__linux__)
+        const int file = exchange(_file, -1);
+
+        return file < 0 or file == STDOUT_FILENO or ::close(file) == 0;
+#else
+        return true;
+#endif
+    }
+
+    string describe() const override { return _path; }
+
+private:
+    string _path;
+
+    int _file = -1;
+};
+
+// A POSIX shared-memory object holding a header and a ring of samples.
+// The writer copies each block in and then publishes the total written;
+// a reader in another process copies out what lies between its own count
+// and that total, and knows it fell behind once the two are more than
+// capacity apart. Nobody waits on anybody.
+class ShmSink : public Sink {
+public:
+    struct Header {
+        char magic[8];
+        uint64_t rate;
+        uint64_t capacity;
+        atomic<uint64_t> written;
+    };
+
+    static_assert(atomic<uint64_t>::is_always_lock_free);
+
+    constexpr static int64_t capacity = 1L << 18;
+
+    constexpr static char magic[8] = {'S', 'Y', 'N', 'T', 'H', 'S', 'H', 'M'};
+
+    ShmSink(const string &name, const float128_t rate)
+        : _name(name), _rate(round(rate)) {}
+
+    ~ShmSink() { close(); }
+
+    bool open() override {
+#if defined(__linux__)
+        const int file =
+            shm_open(_name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+
+        if (file < 0)
+            return false;
+
+        void *data = ftruncate(file, _size) == 0
+                         ? mmap(nullptr, _size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, file, 0)
+                         : MAP_FAILED;
+
+        ::close(file);
+
+        if (data == MAP_FAILED) {
+            shm_unlink(_name.c_str());
+            return false;
+        }
+
+        _header = new (data) Header{{}, uint64_t(_rate), uint64_t(capacity),
+                                    0UL};
+        memcpy(_header->magic, magic, sizeof(magic));
+        _samples = reinterpret_cast<int_osc_t *>(_header + 1);
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool write(const int_osc_t *samples, const int64_t count) override {
+        const uint64_t written = _header->written.load(memory_order_relaxed);
+
+        for (int64_t i = 0; i < count; ++i)
+            _samples[(written + i) & (capacity - 1L)] = samples[i];
+
+        _header->written.store(written + count, memory_order_release);
+
+        return true;
+    }
+
+    bool close() override {
+#if defined(__linux__)
+        if (!_header)
+            return true;
+
+        munmap(_header, _size);
+        shm_unlink(_name.c_str());
+        _header = nullptr;
+#endif
+        return true;
+    }
+
+    string describe() const override { return "shm:" + _name; }
+
+private:
+    constexpr static size_t _size =
+        sizeof(Header) + capacity * sizeof(int_osc_t);
+
+    string _name;
+
+    int64_t _rate;
+
+    Header *_header = nullptr;
+
+    int_osc_t *_samples = nullptr;
+};
+
+// "shm:/name" for shared memory, a path ending in .wav for a WAV file,
+// and anything else, "-" for standard output, for raw PCM.
+unique_ptr<Sink> openSink(const string &target, const float128_t rate) {
+    if (target.starts_with("shm:"))
+        return make_unique<ShmSink>(target.substr(4), rate);
+
+    if (target.ends_with(".wav"))
+        return make_unique<WavSink>(target, rate);
+
+    return make_unique<RawSink>(target);
+}
+
+// Hands blocks of the mix from the audio thread to a sink on a writer
+// thread of its own. The blocks come from a fixed pool: the audio thread
+// renders straight into one it acquired and submits it once the device
+// is done with it, and the writer returns it to the pool after writing,
+// so nothing is copied or allocated on the way. When the writer falls
+// behind by the whole pool, or the sink fails, blocks are discarded and
+// counted instead; the audio thread never waits. The writer sleeps on
+// an atomic between blocks, so a block waits no longer than its write.
+class Recorder {
+public:
+    Recorder(unique_ptr<Sink> sink, const int64_t block)
+        : _sink(move(sink)), _blocks(depth, vector<int_osc_t>(block)) {
+        for (int64_t index = 0; index < depth; ++index)
+            _free.push(index);
+
+        _writer = thread([this]() { _write(); });
+    }
+
+    ~Recorder() {
+        _done.store(true, memory_order_release);
+        _signal.fetch_add(1UL, memory_order_release);
+        _signal.notify_one();
+        _writer.join();
+    }
+
+    Recorder(const Recorder &) = delete;
+    Recorder &operator=(const Recorder &) = delete;
+
+    // A block to render into, or null when the pool is empty. Only the
+    // audio thread may call acquire() and submit().
+    int_osc_t *acquire() {
+        if (!_free.pop(_held)) {
+            _held = -1L;
+            telemetry.discarded.fetch_add(1UL, memory_order_relaxed);
+            return nullptr;
+        }
+
+        return _blocks[_held].data();
+    }
+
+    // Passes the block acquired last to the writer, if there is one.
+    void submit() {
+        if (_held < 0L)
+            return;
+
+        _filled.push(exchange(_held, -1L));
+        _signal.fetch_add(1UL, memory_order_release);
+        _signal.notify_one();
+    }
+
+    constexpr static int64_t depth = 64L;
+
+private:
+    void _write() {
+        bool working = _sink->open();
+
+        if (!working)
+            cerr << "Cannot open output " << _sink->describe() << endl;
+
+        while (true) {
+            const uint64_t signal = _signal.load(memory_order_acquire);
+            const bool done = _done.load(memory_order_acquire);
+            int64_t index;
+
+            while (_filled.pop(index)) {
+                const auto &block = _blocks[index];
+
+                if (working and !_sink->write(block.data(), block.size())) {
+                    cerr << "Cannot write output " << _sink->describe()
+                         << endl;
+                    working = false;
+                }
+
+                (working ? telemetry.recorded : telemetry.discarded)
+                    .fetch_add(1UL, memory_order_relaxed);
+                _free.push(index);
+            }
+
+            if (done)
+                break;
+
+            _signal.wait(signal, memory_order_acquire);
+        }
+
+        if (!_sink->close())
+            cerr << "Cannot close output " << _sink->describe() << endl;
+    }
+
+    unique_ptr<Sink> _sink;
+
+    vector<vector<int_osc_t>> _blocks;
+
+    Ring<int64_t, depth> _free;
+
+    Ring<int64_t, depth> _filled;
+
+    int64_t _held = -1L;
+
+    atomic<uint64_t> _signal = 0UL;
+
+    atomic<bool> _done = false;
+
+    thread _writer;
+};
+
+#endif
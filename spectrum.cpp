@@ -0,0 +1,279 @@
+#if !defined(SPECTRUM)
+#define SPECTRUM
+
+#include "waveform.cpp"
+#include <bit>
+#include <complex>
+#include <span>
+#include <vector>
+
+namespace synth {
+    using namespace std;
+
+    using complex_t = complex<float128_t>;
+
+    // Harmonic amplitudes of a waveform whose value at time is
+    // sum(sine[i] * sin(i * x) + cosine[i] * cos(i * x)) for
+    // x = twoPi * timeByFreq2Cycle(time, freq); cosine[0] holds the offset.
+    struct Spectrum {
+        vector<float128_t> sine;
+        vector<float128_t> cosine;
+
+        int64_t harmonics() const {
+            return int64_t(max(sine.size(), cosine.size()));
+        }
+
+        complex_t at(const int64_t i) const {
+            return {size_t(i) < cosine.size() ? cosine[i] : 0.0L,
+                    size_t(i) < sine.size() ? -sine[i] : 0.0L};
+        }
+    };
+
+    // e^(2 pi i * numer / denom), reducing numer modulo denom exactly
+    // first so that large phases keep their precision.
+    complex_t rootOfUnity(const float128_t numer, const float128_t denom) {
+        return polar(1.0L, twoPi * (fmod(numer, denom) / denom));
+    }
+
+    // In place, with twiddle holding room for at least half the data.
+    void fft(const span<complex_t> data, const span<complex_t> twiddle,
+             const bool inverse = false) {
+        const int64_t size = data.size();
+
+        for (int64_t i = 1, j = 0; i < size; ++i) {
+            int64_t bit = size >> 1;
+
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+
+            j ^= bit;
+
+            if (i < j)
+                swap(data[i], data[j]);
+        }
+
+        for (int64_t i = 0; i < size / 2L; ++i)
+            twiddle[i] = rootOfUnity(inverse ? i : -i, size);
+
+        for (int64_t length = 2L; length <= size; length <<= 1) {
+            const int64_t stride = size / length;
+
+            for (int64_t i = 0; i < size; i += length) {
+                for (int64_t j = 0; j < length / 2L; ++j) {
+                    const complex_t even = data[i + j];
+                    const complex_t odd =
+                        data[i + j + length / 2L] * twiddle[j * stride];
+
+                    data[i + j] = even + odd;
+                    data[i + j + length / 2L] = even - odd;
+                }
+            }
+        }
+
+        if (inverse)
+            for (auto &value : data)
+                value /= float128_t(size);
+    }
+
+    float128_t sampleSpectrum(const Spectrum &spectrum, const int64_t time,
+                              const float128_t freq) {
+        const float128_t period = freq2TPC(freq) - 1.0L;
+        float128_t sum = 0.0L;
+
+        for (int64_t i = 0; i < spectrum.harmonics(); ++i)
+            sum += real(spectrum.at(i) * rootOfUnity(i * time, period));
+
+        return sum;
+    }
+
+    // The buffers a synthesis works in. They only grow, so a caller that
+    // keeps one, sized for the largest synthesis up front, synthesizes
+    // without allocating.
+    struct Synthesis {
+        vector<float128_t> sum;
+        vector<complex_t> signal;
+        vector<complex_t> kernel;
+        vector<complex_t> twiddle;
+    };
+
+    // Evaluates the spectrum at the samples [begin, end) of a table. Few
+    // harmonics are summed by rotating one phasor per sample; many go
+    // through a chirp-z transform, which turns the harmonic sum at every
+    // sample into one convolution and costs O(n log n) independently of
+    // the number of harmonics.
+    void synthesizeSpectrum(const Spectrum &spectrum, float128_t *out,
+                            const int64_t begin, const int64_t end,
+                            const float128_t freq, Synthesis &synthesis) {
+        const float128_t period = freq2TPC(freq) - 1.0L;
+        const int64_t count = end - begin;
+        const int64_t harmonics = spectrum.harmonics();
+
+        if (count <= 0L)
+            return;
+
+        const int64_t size = bit_ceil(uint64_t(count + harmonics));
+
+        if (harmonics <= 3L * int64_t(bit_width(uint64_t(size)))) {
+            for (int64_t time = begin; time < end; ++time) {
+                const complex_t step = rootOfUnity(time, period);
+                complex_t phasor = 1.0L;
+                float128_t sum = 0.0L;
+
+                for (int64_t i = 0; i < harmonics; ++i) {
+                    sum += real(spectrum.at(i) * phasor);
+                    phasor *= step;
+                }
+
+                out[time - begin] = sum;
+            }
+
+            return;
+        }
+
+        // i * t = (i^2 + t^2 - (t - i)^2) / 2 with t counted from begin,
+        // and w^(i^2 / 2) = e^(pi i * i^2 / period).
+        auto chirp = [period](const int64_t k) {
+            return rootOfUnity(float128_t(k) * k, 2.0L * period);
+        };
+
+        auto &signal = synthesis.signal;
+        auto &kernel = synthesis.kernel;
+        auto &twiddle = synthesis.twiddle;
+
+        signal.assign(size, complex_t());
+        kernel.assign(size, complex_t());
+        twiddle.resize(max<size_t>(twiddle.size(), size / 2L));
+
+        for (int64_t i = 0; i < harmonics; ++i)
+            signal[i] = spectrum.at(i) *
+                        rootOfUnity(float128_t(i) * begin, period) * chirp(i);
+
+        for (int64_t k = -harmonics + 1L; k < count; ++k)
+            kernel[(k + size) % size] = conj(chirp(k));
+
+        fft(signal, twiddle);
+        fft(kernel, twiddle);
+
+        for (int64_t i = 0; i < size; ++i)
+            signal[i] *= kernel[i];
+
+        fft(signal, twiddle, true);
+
+        for (int64_t time = 0; time < count; ++time)
+            out[time] = real(chirp(time) * signal[time]);
+    }
+
+    void synthesizeSpectrum(const Spectrum &spectrum, float128_t *out,
+                            const int64_t begin, const int64_t end,
+                            const float128_t freq) {
+        auto synthesis = Synthesis();
+
+        synthesizeSpectrum(spectrum, out, begin, end, freq, synthesis);
+    }
+
+    // Fills the samples [begin, end) of table with the spectrum at amp.
+    void additiveFill(const Spectrum &spectrum, vector<int_osc_t> &table,
+                      const float128_t freq, const float128_t amp,
+                      const int64_t begin, const int64_t end,
+                      Synthesis &synthesis) {
+        auto &sum = synthesis.sum;
+
+        sum.resize(max(end - begin, 0L));
+        synthesizeSpectrum(spectrum, sum.data(), begin, end, freq, synthesis);
+
+        for (int64_t time = begin; time < end; ++time)
+            table[time] = round(amp * sum[time - begin]);
+    }
+
+    BuildWavetable additive(Spectrum spectrum) {
+        return [spectrum](vector<int_osc_t> &table, const float128_t freq,
+                          const float128_t amp) {
+            auto synthesis = Synthesis();
+
+            additiveFill(spectrum, table, freq, amp, 0L, table.size(),
+                         synthesis);
+        };
+    }
+
+    Spectrum transformSpectrum(Spectrum spectrum, const float128_t factor,
+                               const float128_t offset) {
+        spectrum.cosine.resize(max<size_t>(spectrum.cosine.size(), 1));
+
+        for (auto &amplitude : spectrum.sine)
+            amplitude *= factor;
+
+        for (auto &amplitude : spectrum.cosine)
+            amplitude *= factor;
+
+        spectrum.cosine[0] += offset;
+
+        return spectrum;
+    }
+
+    Spectrum scaleWaveformAt(const float128_t division, Spectrum spectrum) {
+        const int64_t time = round(division * (freq2TPC(1.0L) - 1.0L));
+
+        return transformSpectrum(
+            spectrum, 1.0L / sampleSpectrum(spectrum, time, 1.0L), 0.0L);
+    }
+
+    Spectrum shiftWaveformAt(const float128_t division, Spectrum spectrum) {
+        const int64_t time = round(division * (freq2TPC(1.0L) - 1.0L));
+
+        return transformSpectrum(spectrum, 1.0L,
+                                 -sampleSpectrum(spectrum, time, 1.0L));
+    }
+
+    Spectrum expandWaveform(const float128_t factor, Spectrum spectrum) {
+        return transformSpectrum(spectrum, factor, -(factor * 0.5));
+    }
+
+    Spectrum reverseWaveform(Spectrum spectrum) {
+        return transformSpectrum(spectrum, -1.0L, 0.0L);
+    }
+
+    Spectrum identityWaveform(Spectrum spectrum) { return spectrum; }
+
+    Spectrum triangleSpectrum(const int64_t approx) {
+        auto spectrum = Spectrum{vector<float128_t>(2L * approx), {}};
+        float128_t sign = 1.0L;
+
+        for (int64_t i = 1L; i <= approx; ++i) {
+            spectrum.sine[2L * i - 1L] =
+                sign / ((2.0L * i - 1.0L) * (2.0L * i - 1.0L));
+            sign = -sign;
+        }
+
+        return scaleWaveformAt(0.25L, spectrum);
+    }
+
+    Spectrum squareSpectrum(const int64_t approx) {
+        auto spectrum = Spectrum{vector<float128_t>(2L * approx), {}};
+
+        for (int64_t i = 1L; i <= 2L * approx; i += 2L)
+            spectrum.sine[i] = 1.0L / i;
+
+        return scaleWaveformAt(1.0L / (4.0L * approx), spectrum);
+    }
+
+    Spectrum sawtoothSpectrum(const int64_t approx) {
+        auto spectrum = Spectrum{vector<float128_t>(approx + 1L), {}};
+
+        for (int64_t i = 1L; i <= approx; ++i)
+            spectrum.sine[i] = 1.0L / i;
+
+        return scaleWaveformAt(1.0L / (2.0L + 2.0 * approx), spectrum);
+    }
+
+    Spectrum sinePulseSpectrum(const int64_t approx) {
+        auto spectrum = Spectrum{{}, vector<float128_t>(approx + 1L)};
+
+        for (int64_t i = 1L; i <= approx; ++i)
+            spectrum.cosine[i] = -1.0L / (4.0L * i * i - 1.0L);
+
+        return expandWaveform(
+            2.0L, scaleWaveformAt(0.5L, shiftWaveformAt(0L, spectrum)));
+    }
+}
+
+#endif
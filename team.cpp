@@ -0,0 +1,146 @@
+#if !defined(TEAM)
+#define TEAM
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// A fork-join pool for work that must finish within an audio block. The
+// calling thread is member 0; the others are threads of the team's own,
+// each pinned to a core, that sleep on an atomic between runs. run()
+// hands every member a contiguous share of the tasks; a member done with
+// its own share steals from the front of the others', so one slow task
+// does not hold up the rest. Nothing is locked or allocated per run.
+class Team {
+public:
+    Team(const int64_t size = 1L) : _shares(max(size, 1L)) {
+        for (int64_t member = 1; member < int64_t(_shares.size()); ++member) {
+            _members.emplace_back([this, member]() { _work(member); });
+            _pin(_members.back(), member);
+        }
+    }
+
+    ~Team() {
+        _done.store(true, memory_order_release);
+        _generation.fetch_add(1UL, memory_order_release);
+        _generation.notify_all();
+
+        for (auto &member : _members)
+            member.join();
+    }
+
+    Team(const Team &) = delete;
+    Team &operator=(const Team &) = delete;
+
+    int64_t size() const { return _shares.size(); }
+
+    // Runs task(0) to task(count - 1) across the team and returns once
+    // every one has finished; only one thread may call it at a time.
+    void run(const int64_t count, const function<void(int64_t)> &task) {
+        const int64_t size = this->size();
+
+        _task = &task;
+        _finished.store(0L, memory_order_relaxed);
+
+        for (int64_t member = 0; member < size; ++member)
+            _shares[member].store(_share(member * count / size,
+                                         (member + 1L) * count / size),
+                                  memory_order_release);
+
+        _generation.fetch_add(1UL, memory_order_release);
+        _generation.notify_all();
+        _steal(0L);
+
+        while (_finished.load(memory_order_acquire) < count or
+               _busy.load(memory_order_acquire) > 0L)
+            this_thread::yield();
+    }
+
+private:
+    // A share packs the next task and the end of the range into one word,
+    // so that claiming a task is a single compare-and-swap.
+    static uint64_t _share(const uint64_t begin, const uint64_t end) {
+        return begin << 32 | end;
+    }
+
+    static void _pin(thread &member, const int64_t core) {
+#if defined(__linux__)
+        const int64_t cores = max(thread::hardware_concurrency(), 1U);
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(core % cores, &set);
+        pthread_setaffinity_np(member.native_handle(), sizeof(set), &set);
+#endif
+    }
+
+    bool _claim(const int64_t member, int64_t &task) {
+        auto &share = _shares[member];
+        uint64_t range = share.load(memory_order_acquire);
+
+        while ((range >> 32) < (range & 0xffffffffUL))
+            if (share.compare_exchange_weak(range, range + (1UL << 32),
+                                            memory_order_acq_rel)) {
+                task = range >> 32;
+                return true;
+            }
+
+        return false;
+    }
+
+    // Runs the member's own tasks, then any left in the others' shares.
+    void _steal(const int64_t member) {
+        const int64_t size = this->size();
+        int64_t task;
+
+        _busy.fetch_add(1L, memory_order_acq_rel);
+
+        for (int64_t offset = 0; offset < size; ++offset)
+            while (_claim((member + offset) % size, task)) {
+                (*_task)(task);
+                _finished.fetch_add(1L, memory_order_acq_rel);
+            }
+
+        _busy.fetch_sub(1L, memory_order_acq_rel);
+    }
+
+    void _work(const int64_t member) {
+        uint64_t generation = 0UL;
+
+        while (true) {
+            _generation.wait(generation, memory_order_acquire);
+            generation = _generation.load(memory_order_acquire);
+
+            if (_done.load(memory_order_acquire))
+                return;
+
+            _steal(member);
+        }
+    }
+
+    vector<atomic<uint64_t>> _shares;
+
+    vector<thread> _members;
+
+    const function<void(int64_t)> *_task = nullptr;
+
+    atomic<int64_t> _finished = 0L;
+
+    atomic<int64_t> _busy = 0L;
+
+    atomic<uint64_t> _generation = 0UL;
+
+    atomic<bool> _done = false;
+};
+
+#endif
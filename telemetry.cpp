@@ -0,0 +1,176 @@
+#if !defined(TELEMETRY)
+#define TELEMETRY
+
+#include "waveform.cpp"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+using namespace synth;
+
+// Durations in nanoseconds, counted into power-of-two buckets: bucket k
+// holds [2^(k - 1), 2^k). Recording is a handful of relaxed atomic adds,
+// so the audio thread may record while any other thread reads.
+class Histogram {
+public:
+    void record(const int64_t ns) {
+        const uint64_t value = max(ns, 0L);
+        const int64_t bucket =
+            min<int64_t>(bit_width(value), _buckets.size() - 1L);
+        int64_t high = _max.load(memory_order_relaxed);
+
+        _buckets[bucket].fetch_add(1UL, memory_order_relaxed);
+        _count.fetch_add(1UL, memory_order_relaxed);
+        _sum.fetch_add(value, memory_order_relaxed);
+
+        while (high < ns and !_max.compare_exchange_weak(
+                                 high, ns, memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const { return _count.load(memory_order_relaxed); }
+
+    uint64_t at(const int64_t bucket) const {
+        return _buckets[bucket].load(memory_order_relaxed);
+    }
+
+    int64_t peak() const { return _max.load(memory_order_relaxed); }
+
+    float128_t mean() const {
+        const uint64_t count = this->count();
+
+        return count ? float128_t(_sum.load(memory_order_relaxed)) / count
+                     : 0.0L;
+    }
+
+    // The upper bound of the bucket holding the given fraction of samples,
+    // or the largest sample if that is lower.
+    int64_t percentile(const float128_t fraction) const {
+        const uint64_t count = this->count();
+        uint64_t seen = 0;
+
+        for (size_t bucket = 0; bucket < _buckets.size(); ++bucket) {
+            seen += at(bucket);
+
+            if (seen > 0UL and seen >= fraction * count)
+                return min(bucket ? 1L << bucket : 0L, peak());
+        }
+
+        return peak();
+    }
+
+    constexpr static int64_t buckets = 48L;
+
+private:
+    array<atomic<uint64_t>, buckets> _buckets = {};
+
+    atomic<uint64_t> _count = 0UL;
+
+    atomic<uint64_t> _sum = 0UL;
+
+    atomic<int64_t> _max = 0L;
+};
+
+// Everything measured along the path from MIDI input to the audio device.
+// Latency runs from a note event's timestamp to the moment the block
+// carrying it leaves the engine, plus the event's offset into that block;
+// the device's own buffering comes on top. A block overruns when
+// rendering it took longer than it lasts, and an xrun is counted when a
+// block is asked for after the audio already handed over has run out.
+// Blocks sent to an output sink are counted as recorded, or as discarded
+// when the sink's writer was too far behind or had failed. Blocks the
+// limiter turned down are counted as limited, and samples that still
+// passed full scale as clipped. Queued is the deepest the note event queue
+// has been, and events that found it full are counted as dropped.
+struct Telemetry {
+    Histogram latency;
+    Histogram render;
+    atomic<int64_t> deadline = 1L;
+    atomic<uint64_t> blocks = 0UL;
+    atomic<uint64_t> overruns = 0UL;
+    atomic<uint64_t> xruns = 0UL;
+    atomic<uint64_t> recorded = 0UL;
+    atomic<uint64_t> discarded = 0UL;
+    atomic<uint64_t> limited = 0UL;
+    atomic<uint64_t> clipped = 0UL;
+    atomic<int64_t> queued = 0L;
+    atomic<uint64_t> dropped = 0UL;
+
+    // Table build times per waveform; only the builders take the lock.
+    Histogram &build(const string &waveform) {
+        auto lock = unique_lock(_mutex);
+
+        return _builds.try_emplace(waveform).first->second;
+    }
+
+    void dump(ostream &out) {
+        auto line = [&out](const string &name, const Histogram &histogram) {
+            out << name << ": count " << histogram.count() << ", mean "
+                << int64_t(histogram.mean()) << " ns, p50 "
+                << histogram.percentile(0.5L) << " ns, p99 "
+                << histogram.percentile(0.99L) << " ns, max "
+                << histogram.peak() << " ns\n";
+        };
+
+        line("latency", latency);
+        line("render", render);
+        out << "deadline: " << deadline.load(memory_order_relaxed)
+            << " ns\nblocks: " << blocks.load(memory_order_relaxed)
+            << ", overruns: " << overruns.load(memory_order_relaxed)
+            << ", xruns: " << xruns.load(memory_order_relaxed)
+            << "\nrecorded: " << recorded.load(memory_order_relaxed)
+            << ", discarded: " << discarded.load(memory_order_relaxed)
+            << "\nlimited: " << limited.load(memory_order_relaxed)
+            << ", clipped: " << clipped.load(memory_order_relaxed)
+            << "\nqueued: " << queued.load(memory_order_relaxed)
+            << ", dropped: " << dropped.load(memory_order_relaxed) << "\n";
+
+        auto lock = unique_lock(_mutex);
+
+        for (const auto &[waveform, histogram] : _builds)
+            line("build " + waveform, histogram);
+    }
+
+    bool dump(const string &path) {
+        auto file = ofstream(path);
+
+        dump(file);
+
+        return bool(file);
+    }
+
+private:
+    map<string, Histogram> _builds;
+
+    mutex _mutex;
+};
+
+inline Telemetry telemetry;
+
+// Records the lifetime of the scope into a histogram.
+class Stopwatch {
+public:
+    Stopwatch(Histogram &histogram)
+        : _histogram(histogram), _start(steady_clock::now()) {}
+
+    ~Stopwatch() {
+        _histogram.record(
+            duration_cast<nanoseconds>(steady_clock::now() - _start).count());
+    }
+
+private:
+    Histogram &_histogram;
+
+    steady_clock::time_point _start;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#if !defined(VOICING)
+#define VOICING
+
+#include "cache.cpp"
+#include "kernel.cpp"
+#include "noise.cpp"
+#include "resample.cpp"
+#include "spectrum.cpp"
+#include "waveform.cpp"
+#include "wavetable.cpp"
+#include <cctype>
+#include <optional>
+#include <string>
+
+using namespace std;
+using namespace synth;
+
+// A choice of waveform and everything that shapes its tables, as the
+// frontend's keys set it and the offline renderer's options do.
+struct Voicing {
+    int64_t select = 0L;
+    int64_t approx = 1L;
+    float128_t division = 0.5L;
+    bool reverse = false;
+    Precision precision = Precision::Reference;
+    uint64_t seed = 0UL;
+    Derivation derivation = Derivation::Spectral;
+    bool mirror = true;
+};
+
+constexpr int64_t waveforms = 12L;
+
+string waveformName(const int64_t select) {
+    switch (select) {
+        case 0:
+            return "Sine";
+        case 1:
+            return "Triangle";
+        case 2:
+            return "Triangle Fourier";
+        case 3:
+            return "Square";
+        case 4:
+            return "Square Fourier";
+        case 5:
+            return "Sawtooth";
+        case 6:
+            return "Sawtooth Fourier";
+        case 7:
+            return "Sine Pulse";
+        case 8:
+            return "Sine Pulse Fourier";
+        case 9:
+            return "White Noise";
+        case 10:
+            return "Pink Noise";
+        default:
+            return "Brown Noise";
+    }
+}
+
+// A waveform by number, or by its name in any case with dashes for
+// spaces, e.g. square-fourier.
+int64_t parseWaveform(const string &name) {
+    for (int64_t select = 0; select < waveforms; ++select) {
+        auto known = waveformName(select);
+
+        for (auto &c : known)
+            c = c == ' ' ? '-' : tolower(c);
+
+        if (known == name or to_string(select) == name)
+            return select;
+    }
+
+    return -1L;
+}
+
+// The additive waveforms' spectrum, and none for the others.
+Spectrum spectrumOf(const Voicing &voicing) {
+    auto spectrum = Spectrum();
+
+    switch (voicing.select) {
+        case 2:
+            spectrum = triangleSpectrum(voicing.approx);
+            break;
+        case 4:
+            spectrum = squareSpectrum(voicing.approx);
+            break;
+        case 6:
+            spectrum = sawtoothSpectrum(voicing.approx);
+            break;
+        case 8:
+            spectrum = sinePulseSpectrum(voicing.approx);
+            break;
+        default:
+            return spectrum;
+    }
+
+    return voicing.reverse ? reverseWaveform(spectrum) : spectrum;
+}
+
+BuildWavetable builderOf(const Voicing &voicing) {
+    auto sample = [&voicing](auto waveform,
+                             optional<Kernel> kernel = nullopt) {
+        if (voicing.reverse and kernel)
+            kernel = reverseWaveform(*kernel);
+
+        const auto symmetry =
+            voicing.mirror ? symmetryOf(waveform) : Symmetry::None;
+
+        return voicing.reverse
+                   ? symmetric(evaluate(reverseWaveform(waveform), kernel,
+                                        voicing.precision),
+                               symmetry)
+                   : symmetric(evaluate(waveform, kernel, voicing.precision),
+                               symmetry);
+    };
+
+    switch (voicing.select) {
+        case 0:
+            return sample(sineWaveform, Kernel{Kernel::Sine});
+        case 1:
+            return sample(triangleWaveform, Kernel{Kernel::Triangle});
+        case 2:
+            return additive(spectrumOf(voicing));
+        case 3:
+            return sample(squareWaveform(voicing.division),
+                          Kernel{Kernel::Square, voicing.division});
+        case 4:
+            return additive(spectrumOf(voicing));
+        case 5:
+            return sample(sawtoothWaveform, Kernel{Kernel::Sawtooth});
+        case 6:
+            return additive(spectrumOf(voicing));
+        case 7:
+            return sample(sinePulseWaveform, Kernel{Kernel::SinePulse});
+        case 8:
+            return additive(spectrumOf(voicing));
+        case 9:
+            return sample(Noise{Noise::White, voicing.seed});
+        case 10:
+            return sample(Noise{Noise::Pink, voicing.seed});
+        default:
+            return sample(Noise{Noise::Brown, voicing.seed});
+    }
+}
+
+// Only the parameters the waveform reads go into the key.
+TableKey keyOf(const Voicing &voicing) {
+    const int64_t select = voicing.select;
+    auto key = TableKey{select, 0L, 0.0L, voicing.reverse};
+
+    key.derivation = voicing.derivation;
+
+    if (select == 2 or select == 4 or select == 6 or select == 8)
+        key.approx = voicing.approx;
+    else if (select < 9)
+        key.precision = voicing.precision;
+    else
+        key.seed = voicing.seed;
+
+    if (select == 3)
+        key.division = voicing.division;
+
+    return key;
+}
+
+Patch patchOf(const Voicing &voicing) {
+    return {builderOf(voicing), keyOf(voicing), waveformName(voicing.select),
+            spectrumOf(voicing)};
+}
+
+#endif
@@ -0,0 +1,97 @@
+#if !defined(WAV)
+#define WAV
+
+#include "waveform.cpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using namespace std;
+using namespace synth;
+
+// Streams 16-bit PCM into a WAV file. The header goes out first with
+// empty sizes, which close() fills in once the length is known, so that
+// no more than one block is ever held in memory. Assumes a
+// little-endian host, as the table cache does.
+class WavWriter {
+public:
+    WavWriter() = default;
+
+    WavWriter(const WavWriter &) = delete;
+    WavWriter &operator=(const WavWriter &) = delete;
+
+    ~WavWriter() { close(); }
+
+    bool open(const string &path, const int64_t rate,
+              const int64_t channels = 1L) {
+        close();
+
+        _file = fopen(path.c_str(), "wb");
+        _bytes = 0UL;
+        _header = Header{
+            {'R', 'I', 'F', 'F'}, 36U, {'W', 'A', 'V', 'E'},
+            {'f', 'm', 't', ' '}, 16U, 1U, uint16_t(channels),
+            uint32_t(rate), uint32_t(rate * channels * sizeof(int_osc_t)),
+            uint16_t(channels * sizeof(int_osc_t)), 16U,
+            {'d', 'a', 't', 'a'}, 0U};
+
+        return _file and fwrite(&_header, sizeof(_header), 1, _file) == 1;
+    }
+
+    bool write(const int_osc_t *samples, const int64_t count) {
+        if (!_file or
+            fwrite(samples, sizeof(int_osc_t), count, _file) != size_t(count))
+            return false;
+
+        _bytes += count * sizeof(int_osc_t);
+
+        return true;
+    }
+
+    // Patches the sizes into the header; a file past 4 GiB keeps the
+    // largest sizes the format can state.
+    bool close() {
+        if (!_file)
+            return true;
+
+        const uint64_t limit = UINT32_MAX - 36UL;
+
+        _header.data = min(_bytes, limit);
+        _header.riff = _header.data + 36U;
+
+        bool written = fseek(_file, 0L, SEEK_SET) == 0 and
+                       fwrite(&_header, sizeof(_header), 1, _file) == 1;
+
+        written = fclose(_file) == 0 and written;
+        _file = nullptr;
+
+        return written;
+    }
+
+private:
+    struct Header {
+        char riffTag[4];
+        uint32_t riff;
+        char wave[4];
+        char formatTag[4];
+        uint32_t format;
+        uint16_t encoding;
+        uint16_t channels;
+        uint32_t rate;
+        uint32_t byteRate;
+        uint16_t frame;
+        uint16_t bits;
+        char dataTag[4];
+        uint32_t data;
+    };
+
+    static_assert(sizeof(Header) == 44);
+
+    FILE *_file = nullptr;
+
+    Header _header;
+
+    uint64_t _bytes = 0UL;
+};
+
+#endif
@@ -5,20 +5,25 @@
 #include <cmath>
 #include <limits>
 
-#if defined(__linux__)
-#include <sys/random.h>
-#endif
-
 namespace synth {
     using namespace std;
 
     using int_osc_t = int16_t;
     using float128_t = long double;
 
+    // Waveforms and their combinators are plain functors, so that a
+    // composition instantiates the builders below into a single inlined
+    // loop; ApplyWaveform and BuildWavetable only erase the type once per
+    // table, for callers that pick a waveform at runtime.
     using ApplyWaveform = function<float128_t(const int64_t, const float128_t)>;
 
-    using BuildWavetable =
-        function<void(vector<int_osc_t> &, const float128_t, const float128_t)>;
+    // A fill evaluates the samples [begin, end) of a table.
+    using FillWavetable =
+        function<void(vector<int_osc_t> &, const float128_t, const float128_t,
+                      const int64_t, const int64_t)>;
+
+    using BuildWavetable = function<void(vector<int_osc_t> &, const float128_t,
+                                         const float128_t)>;
 
     constexpr float128_t pi = 0x3.243f6a8885a308d313198a2e03707344p0L;
     constexpr float128_t piDivTwo = pi / 2.0L;
@@ -28,6 +33,7 @@ namespace synth {
 
     constexpr float128_t maxAmp = numeric_limits<int_osc_t>::max();
     constexpr float128_t stdRate = 8388608.0L; // 262144; // 1048576; // 8388608.0L;
+    constexpr float128_t defaultRate = 48000.0L;
     constexpr float128_t stdFreq = 440.0L;
 
     constexpr float128_t freq2TPC(const float128_t freq,
@@ -44,51 +50,93 @@ namespace synth {
         return time / (freq2TPC(freq) - 1.0L);
     }
 
-    ApplyWaveform scaleWaveformAt(const float128_t division,
-                                  ApplyWaveform apply) {
+    // What a waveform repeats within one cycle of tpc samples:
+    // Axisymmetric, f(tpc - t) = f(t); Pointsymmetric, f(tpc - t) = -f(t);
+    // Periodic, pointsymmetric and also f(tpc / 2 - t) = f(t).
+    enum class Symmetry { None, Axisymmetric, Pointsymmetric, Periodic };
+
+    // A waveform that declares its symmetry. Waveforms that do not are
+    // assumed to have none.
+    template <class Apply> struct Symmetric {
+        Apply apply;
+        Symmetry symmetry;
+
+        float128_t operator()(const int64_t time, const float128_t freq) const {
+            return apply(time, freq);
+        }
+    };
+
+    template <class Apply> constexpr Symmetry symmetryOf(const Apply &) {
+        return Symmetry::None;
+    }
+
+    template <class Apply>
+    constexpr Symmetry symmetryOf(const Symmetric<Apply> &waveform) {
+        return waveform.symmetry;
+    }
+
+    // Scaling and negating keep a symmetry; adding an offset keeps only
+    // the axis.
+    constexpr Symmetry offsetSymmetry(const Symmetry symmetry) {
+        return symmetry == Symmetry::Axisymmetric ? symmetry : Symmetry::None;
+    }
+
+    template <class Apply>
+    auto scaleWaveformAt(const float128_t division, Apply apply) {
         const int64_t time = round(division * (freq2TPC(1.0L) - 1.0L));
         const float128_t scale = 1.0L / apply(time, 1.0L);
-
-        return [scale, apply](int64_t time, float128_t freq) {
+        auto scaled = [scale, apply](int64_t time, float128_t freq) {
             return scale * apply(time, freq);
         };
+
+        return Symmetric{scaled, symmetryOf(apply)};
     }
 
-    ApplyWaveform shiftWaveformAt(const float128_t division,
-                                  ApplyWaveform apply) {
+    template <class Apply>
+    auto shiftWaveformAt(const float128_t division, Apply apply) {
         const int64_t time = round(division * (freq2TPC(1.0L) - 1.0L));
         const float128_t shift = apply(time, 1.0L);
-
-        return [apply, shift](const int64_t time, const float128_t freq) {
+        auto shifted = [apply, shift](const int64_t time,
+                                      const float128_t freq) {
             return apply(time, freq) - shift;
         };
+
+        return Symmetric{shifted, offsetSymmetry(symmetryOf(apply))};
     }
 
-    ApplyWaveform expandWaveform(const float128_t factor, ApplyWaveform apply) {
-        return [factor, apply](const int64_t time, const float128_t freq) {
+    template <class Apply>
+    auto expandWaveform(const float128_t factor, Apply apply) {
+        auto expanded = [factor, apply](const int64_t time,
+                                        const float128_t freq) {
             return factor * apply(time, freq) - (factor * 0.5);
         };
+
+        return Symmetric{expanded, offsetSymmetry(symmetryOf(apply))};
     }
 
-    ApplyWaveform reverseWaveform(ApplyWaveform apply) {
-        return [apply](const int64_t time, const float128_t freq) {
+    template <class Apply> auto reverseWaveform(Apply apply) {
+        auto reversed = [apply](const int64_t time, const float128_t freq) {
             return -apply(time, freq);
         };
+
+        return Symmetric{reversed, symmetryOf(apply)};
     }
 
-    ApplyWaveform identityWaveform(ApplyWaveform apply) { return apply; }
+    template <class Apply> auto identityWaveform(Apply apply) { return apply; }
 
-    constexpr float128_t sineWaveform(const int64_t time,
-                                      const float128_t freq) {
-        return sin(twoPi * timeByFreq2Cycle(time, freq));
-    }
+    constexpr auto sineWaveform = Symmetric{
+        [](const int64_t time, const float128_t freq) {
+            return sin(twoPi * timeByFreq2Cycle(time, freq));
+        },
+        Symmetry::Periodic};
 
-    constexpr float128_t triangleWaveform(const int64_t time,
-                                          const float128_t freq) {
-        return twoDivPi * asin(sin(twoPi * timeByFreq2Cycle(time, freq)));
-    }
+    constexpr auto triangleWaveform = Symmetric{
+        [](const int64_t time, const float128_t freq) {
+            return twoDivPi * asin(sin(twoPi * timeByFreq2Cycle(time, freq)));
+        },
+        Symmetry::Periodic};
 
-    ApplyWaveform triangleWaveformFourier(const int64_t approx) {
+    auto triangleWaveformFourier(const int64_t approx) {
         auto apply = [approx](const int64_t time, const float128_t freq) {
             float128_t sum = 0.0L;
             float128_t sign = -1.0L;
@@ -104,10 +152,10 @@ namespace synth {
             return -sum;
         };
 
-        return scaleWaveformAt(0.25L, apply);
+        return scaleWaveformAt(0.25L, Symmetric{apply, Symmetry::Periodic});
     }
 
-    ApplyWaveform squareWaveform(const float128_t division) {
+    auto squareWaveform(const float128_t division) {
         return [division](const int64_t time, const float128_t freq) {
             const float128_t tpc = freq2TPC(freq);
 
@@ -115,7 +163,7 @@ namespace synth {
         };
     }
 
-    ApplyWaveform squareWaveformFourier(const int64_t approx) {
+    auto squareWaveformFourier(const int64_t approx) {
         auto apply = [approx](const int64_t time, const float128_t freq) {
             float128_t sum = 0.0L;
 
@@ -125,16 +173,19 @@ namespace synth {
             return sum;
         };
 
-        return scaleWaveformAt(1.0L / (4.0L * approx), apply);
+        return scaleWaveformAt(1.0L / (4.0L * approx),
+                               Symmetric{apply, Symmetry::Periodic});
     }
 
-    constexpr float128_t sawtoothWaveform(const int64_t time,
-                                          const float128_t freq) {
-        return -twoDivPi *
-               (freq2Cycle(freq) * pi * fmod(time, freq2TPC(freq)) - piDivTwo);
-    }
+    constexpr auto sawtoothWaveform = Symmetric{
+        [](const int64_t time, const float128_t freq) {
+            return -twoDivPi * (freq2Cycle(freq) * pi *
+                                    fmod(time, freq2TPC(freq)) -
+                                piDivTwo);
+        },
+        Symmetry::Pointsymmetric};
 
-    ApplyWaveform sawtoothWaveformFourier(const int64_t approx) {
+    auto sawtoothWaveformFourier(const int64_t approx) {
         auto apply = [approx](const int64_t time, const float128_t freq) {
             float128_t sum = 0.0L;
 
@@ -144,15 +195,17 @@ namespace synth {
             return sum;
         };
 
-        return scaleWaveformAt(1.0L / (2.0L + 2.0 * approx), apply);
+        return scaleWaveformAt(1.0L / (2.0L + 2.0 * approx),
+                               Symmetric{apply, Symmetry::Pointsymmetric});
     }
 
-    constexpr float128_t sinePulseWaveform(const int64_t time,
-                                           const float128_t freq) {
-        return 2.0L * abs(sin(pi * timeByFreq2Cycle(time, freq))) - 1.0;
-    }
+    constexpr auto sinePulseWaveform = Symmetric{
+        [](const int64_t time, const float128_t freq) {
+            return 2.0L * abs(sin(pi * timeByFreq2Cycle(time, freq))) - 1.0;
+        },
+        Symmetry::Axisymmetric};
 
-    ApplyWaveform sinePulseWaveformFourier(const int64_t approx) {
+    auto sinePulseWaveformFourier(const int64_t approx) {
         auto apply = [approx](const int64_t time, const float128_t freq) {
             float128_t sum = 0.0L;
 
@@ -163,90 +216,143 @@ namespace synth {
             return -sum;
         };
 
-        return expandWaveform(
-            2.0L, scaleWaveformAt(0.5L, shiftWaveformAt(0L, apply)));
-    }
+        const auto even = Symmetric{apply, Symmetry::Axisymmetric};
 
-    float128_t randomNoise(const int64_t time, const float128_t freq) {
-        if constexpr (__linux__) {
-            int_osc_t buffer;
-            getrandom(&buffer, sizeof(int_osc_t), GRND_RANDOM);
-            return buffer / maxAmp;
-        } else {
-            return 0;
-        }
+        return expandWaveform(
+            2.0L, scaleWaveformAt(0.5L, shiftWaveformAt(0L, even)));
     }
 
-    constexpr float128_t maxWaveform(const int64_t time,
-                                     const float128_t freq) {
+    constexpr auto maxWaveform = [](const int64_t time,
+                                    const float128_t freq) {
         return 1.0L;
-    }
+    };
 
-    constexpr float128_t ecuadorWaveform(const int64_t time,
-                                         const float128_t freq) {
+    constexpr auto ecuadorWaveform = [](const int64_t time,
+                                        const float128_t freq) {
         return 0.0L;
-    }
+    };
 
-    constexpr float128_t minWaveform(const int64_t time,
-                                     const float128_t freq) {
+    constexpr auto minWaveform = [](const int64_t time,
+                                    const float128_t freq) {
         return -1.0L;
-    }
+    };
 
-    BuildWavetable variadic(ApplyWaveform apply) {
+    template <class Apply> FillWavetable evaluate(Apply apply) {
         return [apply](vector<int_osc_t> &table, const float128_t freq,
-                       const float128_t amp) {
-            const int64_t tpc = table.size();
-
-            for (int64_t time = 0L; time < tpc; ++time)
+                       const float128_t amp, const int64_t begin,
+                       const int64_t end) {
+            for (int64_t time = begin; time < end; ++time)
                 table[time] = round(amp * apply(time, freq));
         };
     }
 
-    BuildWavetable axisymmetric(ApplyWaveform apply) {
-        return [apply](vector<int_osc_t> &table, const float128_t freq,
-                       const float128_t amp) {
+    BuildWavetable variadic(FillWavetable fill) {
+        return [fill](vector<int_osc_t> &table, const float128_t freq,
+                      const float128_t amp) {
+            fill(table, freq, amp, 0L, table.size());
+        };
+    }
+
+    // The builders below fill the samples [0, tpc / 2] and copy each sample
+    // t in [1, tpc / 2) to tpc - t, leaving the middle sample of an even
+    // table to the fill: mirroring it onto itself would negate it.
+    BuildWavetable axisymmetric(FillWavetable fill) {
+        return [fill](vector<int_osc_t> &table, const float128_t freq,
+                      const float128_t amp) {
             const int64_t tpc = table.size();
-            const int64_t half = tpc / 2L;
 
-            for (int64_t time = 0L; time <= half; ++time)
-                table[time] = round(amp * apply(time, freq));
+            fill(table, freq, amp, 0L, tpc / 2L + 1L);
 
-            for (int64_t time = 1L; time <= half; ++time)
+            for (int64_t time = 1L; 2L * time < tpc; ++time)
                 table[tpc - time] = table[time];
         };
     }
 
-    BuildWavetable pointsymmetric(ApplyWaveform apply) {
-        return [apply](vector<int_osc_t> &table, const float128_t freq,
-                       const float128_t amp) {
+    BuildWavetable pointsymmetric(FillWavetable fill) {
+        return [fill](vector<int_osc_t> &table, const float128_t freq,
+                      const float128_t amp) {
             const int64_t tpc = table.size();
-            const int64_t half = tpc / 2L;
 
-            for (int64_t time = 0L; time <= half; ++time)
-                table[time] = round(amp * apply(time, freq));
+            fill(table, freq, amp, 0L, tpc / 2L + 1L);
 
-            for (int64_t time = 1; time <= half; ++time)
+            for (int64_t time = 1L; 2L * time < tpc; ++time)
                 table[tpc - time] = -table[time];
         };
     }
 
-    BuildWavetable periodic(ApplyWaveform apply) {
-        return [apply](vector<int_osc_t> &table, const float128_t freq,
-                       const float128_t amp) {
+    // Only an even table has a sample at half a cycle to fold the quarter
+    // around; an odd one falls back to the pointsymmetric half.
+    BuildWavetable periodic(FillWavetable fill) {
+        return [fill](vector<int_osc_t> &table, const float128_t freq,
+                      const float128_t amp) {
             const int64_t tpc = table.size();
             const int64_t half = tpc / 2L;
-            const int64_t quart = tpc / 4L;
 
-            for (int64_t time = 0L; time <= quart; ++time)
-                table[time] = round(amp * apply(time, freq));
+            fill(table, freq, amp, 0L,
+                 tpc % 2L ? tpc / 2L + 1L : tpc / 4L + 1L);
 
-            for (int64_t time = 0L; time <= quart; ++time)
-                table[half - time] = table[time];
+            if (tpc % 2L == 0L)
+                for (int64_t time = 0L; time <= tpc / 4L; ++time)
+                    table[half - time] = table[time];
 
-            for (int64_t time = 1L; time <= half + 1; ++time)
+            for (int64_t time = 1L; 2L * time < tpc; ++time)
                 table[tpc - time] = -table[time];
         };
     }
+
+    // The cheapest builder that a waveform's symmetry allows.
+    BuildWavetable symmetric(FillWavetable fill, const Symmetry symmetry) {
+        switch (symmetry) {
+            case Symmetry::Axisymmetric:
+                return axisymmetric(fill);
+            case Symmetry::Pointsymmetric:
+                return pointsymmetric(fill);
+            case Symmetry::Periodic:
+                return periodic(fill);
+            default:
+                return variadic(fill);
+        }
+    }
+
+    template <class Apply> BuildWavetable variadic(Apply apply) {
+        return variadic(evaluate(apply));
+    }
+
+    template <class Apply> BuildWavetable axisymmetric(Apply apply) {
+        return axisymmetric(evaluate(apply));
+    }
+
+    template <class Apply> BuildWavetable pointsymmetric(Apply apply) {
+        return pointsymmetric(evaluate(apply));
+    }
+
+    template <class Apply> BuildWavetable periodic(Apply apply) {
+        return periodic(evaluate(apply));
+    }
+
+    template <class Apply> BuildWavetable symmetric(Apply apply) {
+        return symmetric(evaluate(apply), symmetryOf(apply));
+    }
+
+    // Largest deviation, in LSB of int_osc_t, of a mirrored build from a
+    // reference one, typically variadic, over one cycle of tpc samples:
+    // anything above a rounding step means that a declared symmetry or a
+    // mirror is wrong.
+    int64_t symmetryError(const BuildWavetable &build,
+                          const BuildWavetable &reference, const int64_t tpc) {
+        auto mirrored = vector<int_osc_t>(tpc);
+        auto full = vector<int_osc_t>(tpc);
+        const float128_t freq = stdRate / (tpc + 1.0L);
+        int64_t error = 0;
+
+        build(mirrored, freq, maxAmp);
+        reference(full, freq, maxAmp);
+
+        for (int64_t time = 0; time < tpc; ++time)
+            error = max<int64_t>(error, abs(mirrored[time] - full[time]));
+
+        return error;
+    }
 }
 
 #endif
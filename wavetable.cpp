@@ -0,0 +1,249 @@
+#if !defined(WAVETABLE)
+#define WAVETABLE
+
+#include "arena.cpp"
+#include "spectrum.cpp"
+#include "waveform.cpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace synth {
+    using namespace std;
+
+    constexpr int64_t cycleLength = 2048L;
+
+    // The shortest level: below it linear interpolation would no longer
+    // trace even a sine, so the top octaves of a wide range share it.
+    constexpr int64_t minLength = 64L;
+
+    // The frequency at which the waveforms complete one cycle every tpc
+    // samples, i.e. the inverse of freq2TPC(freq) - 1.
+    constexpr float128_t tpc2Freq(const float128_t tpc) {
+        return stdRate / (tpc + 1.0L);
+    }
+
+    // One band-limited cycle per octave above base. Level k holds only
+    // the harmonics that stay below Nyquist for every note up to
+    // base * 2^(k + 1), in the fewest samples, a power of two, that hold
+    // them, but no more than cycleLength and no fewer than minLength; a
+    // note is played by stepping through its level increment(freq)
+    // samples per output sample.
+    //
+    // The levels lie one after another in a single aligned arena, widest
+    // first; their lengths are multiples of a cache line, so each starts
+    // on one. A copy gets an arena of its own.
+    struct Mipmap {
+        Mipmap(const float128_t base, const float128_t top,
+               const float128_t rate)
+            : base(base), rate(rate),
+              levels(max(int64_t(floor(log2(top / base))) + 1L, 1L)) {
+            size_t offset = 0;
+
+            for (size_t k = 0; k < levels.size(); ++k)
+                offset += _length(k);
+
+            _arena = allocateSamples(offset);
+            _size = offset;
+            offset = 0UL;
+
+            for (size_t k = 0; k < levels.size(); ++k) {
+                const size_t length = _length(k);
+
+                levels[k] = span(_arena.get() + offset, length);
+                offset += length;
+            }
+        }
+
+        Mipmap(const Mipmap &other)
+            : base(other.base), rate(other.rate), levels(other.levels),
+              _arena(allocateSamples(other._size)), _size(other._size) {
+            memcpy(_arena.get(), other._arena.get(),
+                   _size * sizeof(int_osc_t));
+
+            for (auto &level : levels)
+                level = span(_arena.get() + (level.data() - other._arena.get()),
+                             level.size());
+        }
+
+        Mipmap(Mipmap &&) = default;
+
+        Mipmap &operator=(const Mipmap &other) {
+            return *this = Mipmap(other);
+        }
+
+        Mipmap &operator=(Mipmap &&) = default;
+
+        float128_t base;
+        float128_t rate;
+        vector<span<int_osc_t>> levels;
+
+        // Every level's samples at once, as they lie in the arena.
+        span<int_osc_t> samples() { return span(_arena.get(), _size); }
+
+        span<const int_osc_t> samples() const {
+            return span(_arena.get(), _size);
+        }
+
+        int64_t level(const float128_t freq) const {
+            return clamp<int64_t>(floor(log2(freq / base)), 0L,
+                                  levels.size() - 1L);
+        }
+
+        span<const int_osc_t> at(const float128_t freq) const {
+            return levels[level(freq)];
+        }
+
+        float128_t increment(const float128_t freq) const {
+            return freq * at(freq).size() / rate;
+        }
+
+        int64_t harmonics(const int64_t k) const {
+            return clamp<int64_t>(_nyquist(k), 1L, levels[k].size() / 2L - 1L);
+        }
+
+    private:
+        // The highest harmonic below Nyquist up to the top of level k.
+        int64_t _nyquist(const int64_t k) const {
+            return floor(rate / (2.0L * base * exp2(k + 1.0L)));
+        }
+
+        size_t _length(const int64_t k) const {
+            const int64_t needed = 2L * (min(_nyquist(k), cycleLength) + 1L);
+
+            return clamp<int64_t>(bit_ceil(uint64_t(needed)), minLength,
+                                  cycleLength);
+        }
+
+        Samples _arena;
+
+        size_t _size = 0UL;
+    };
+
+    // Reads a level at a phase in cycles with linear interpolation; level
+    // lengths are powers of two, so the wrap is a mask.
+    [[gnu::always_inline]] inline float
+    interpolate(const span<const int_osc_t> table, const double phase) {
+        const int64_t length = table.size();
+        const double position = phase * length;
+        const int64_t index = position;
+        const float frac = position - index;
+        const float from = table[index];
+        const float to = table[(index + 1L) & (length - 1L)];
+
+        return from + frac * (to - from);
+    }
+
+    vector<int_osc_t> renderCycle(const BuildWavetable &build,
+                                  const int64_t length = cycleLength,
+                                  const float128_t amp = maxAmp) {
+        auto cycle = vector<int_osc_t>(length);
+
+        build(cycle, tpc2Freq(length), amp);
+
+        return cycle;
+    }
+
+    // The buffers a mipmap's build works in, sized up front so that an
+    // instrument that keeps one rebuilds its tables without touching the
+    // heap. A factor above one also makes room for a cycle oversampled
+    // that many times, each level filtered from it, and the cycle
+    // wrapped around a low-pass filter of up to eight times its length.
+    // Additive cycles are synthesized in room for as many harmonics as
+    // the cycle has samples; more grow it once.
+    struct Scratch {
+        Scratch(const Mipmap &mipmap, const int64_t factor = 1L)
+            : spectrum(cycleLength), level(cycleLength),
+              twiddle(cycleLength / 2L) {
+            const int64_t length = cycleLength * factor;
+
+            cycle.reserve(length);
+            synthesis.sum.reserve(length);
+            synthesis.signal.reserve(2L * length);
+            synthesis.kernel.reserve(2L * length);
+            synthesis.twiddle.reserve(length);
+
+            if (factor > 1L) {
+                filtered.reserve(mipmap.samples().size());
+                taps.reserve(9L * length);
+                padded.reserve(10L * length);
+            }
+        }
+
+        vector<int_osc_t> cycle;
+        vector<complex_t> spectrum;
+        vector<complex_t> level;
+        vector<complex_t> twiddle;
+        vector<float> filtered;
+        vector<float> taps;
+        vector<float> padded;
+        Synthesis synthesis;
+    };
+
+    // Resynthesizes harmonics [0, harmonics] of a cycle's spectrum into
+    // table, tapering them with Lanczos sigma factors so that the cut does
+    // not ring into overshoot.
+    void bandlimit(const span<const complex_t> spectrum,
+                   const span<int_osc_t> table, const int64_t harmonics,
+                   Scratch &scratch) {
+        const int64_t size = spectrum.size();
+        const int64_t length = table.size();
+        const float128_t gain = float128_t(length) / size;
+        const auto cycle = span(scratch.level).first(length);
+
+        fill(cycle.begin(), cycle.end(), complex_t());
+        cycle[0] = gain * spectrum[0];
+
+        for (int64_t k = 1L; k <= harmonics; ++k) {
+            const float128_t x = pi * k / (harmonics + 1L);
+            const float128_t sigma = sin(x) / x;
+
+            cycle[k] = gain * sigma * spectrum[k];
+            cycle[length - k] = gain * sigma * spectrum[size - k];
+        }
+
+        fft(cycle, scratch.twiddle, true);
+
+        for (int64_t time = 0; time < length; ++time)
+            table[time] = clamp(round(real(cycle[time])), -maxAmp, maxAmp);
+    }
+
+    // Cuts the cycle in scratch down to every level of mipmap.
+    void bandlimitCycle(Mipmap &mipmap, Scratch &scratch) {
+        const auto &cycle = scratch.cycle;
+        auto &spectrum = scratch.spectrum;
+
+        copy(cycle.begin(), cycle.end(), spectrum.begin());
+        fft(spectrum, scratch.twiddle);
+
+        for (size_t k = 0; k < mipmap.levels.size(); ++k)
+            bandlimit(spectrum, mipmap.levels[k], mipmap.harmonics(k),
+                      scratch);
+    }
+
+    void renderMipmap(Mipmap &mipmap, const BuildWavetable &build,
+                      Scratch &scratch) {
+        scratch.cycle.resize(cycleLength);
+        build(scratch.cycle, tpc2Freq(cycleLength), maxAmp);
+        bandlimitCycle(mipmap, scratch);
+    }
+
+    // As additive(spectrum) would render it, in the scratch's buffers.
+    void renderMipmap(Mipmap &mipmap, const Spectrum &spectrum,
+                      Scratch &scratch) {
+        scratch.cycle.resize(cycleLength);
+        additiveFill(spectrum, scratch.cycle, tpc2Freq(cycleLength), maxAmp,
+                     0L, cycleLength, scratch.synthesis);
+        bandlimitCycle(mipmap, scratch);
+    }
+
+    void renderMipmap(Mipmap &mipmap, const BuildWavetable &build) {
+        auto scratch = Scratch(mipmap);
+
+        renderMipmap(mipmap, build, scratch);
+    }
+}
+
+#endif